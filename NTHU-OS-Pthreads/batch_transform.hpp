@@ -0,0 +1,72 @@
+#include <vector>
+#include "item.hpp"
+#include "transformer.hpp"
+#include "stats.hpp"
+#include "cost_model.hpp"
+#include "transform_cache.hpp"
+
+#ifndef BATCH_TRANSFORM_HPP
+#define BATCH_TRANSFORM_HPP
+
+// producer_transform_batch or consumer_transform_batch
+typedef void (Transformer::*TransformBatch)(char opcode, unsigned long long* vals, int n);
+
+// Transforms the values of n items in place,
+// the items sharing an opcode go through one transform_batch call,
+// whose time per item is recorded in stats and fed to costs if given.
+// With a cache, the items whose value it holds are not transformed again and
+// the results of the others are added to it.
+void transform_items(Transformer* transformer, TransformBatch transform_batch, Item** items, int n,
+	Stats::Recorder* stats = nullptr, CostModel* costs = nullptr, TransformCache* cache = nullptr);
+
+// Implementation start
+
+void transform_items(Transformer* transformer, TransformBatch transform_batch, Item** items, int n,
+	Stats::Recorder* stats, CostModel* costs, TransformCache* cache) {
+	// per thread and kept across calls, so they grow to the largest batch
+	// once instead of being allocated for every one
+	static thread_local std::vector<bool> done;
+	static thread_local std::vector<unsigned long long> vals;
+	static thread_local std::vector<int> group;
+	done.assign(n, false);
+
+	TransformCache::Stage stage = transform_batch == &Transformer::producer_transform_batch
+		? TransformCache::PRODUCER : TransformCache::CONSUMER;
+	if (cache) {
+		for (int i = 0; i < n; i++)
+			done[i] = cache->lookup(stage, items[i]->opcode, items[i]->val, &items[i]->val);
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (done[i])
+			continue;
+
+		vals.clear();
+		group.clear();
+		for (int j = i; j < n; j++) {
+			if (!done[j] && items[j]->opcode == items[i]->opcode) {
+				vals.push_back(items[j]->val);
+				group.push_back(j);
+				done[j] = true;
+			}
+		}
+
+		bool timed = stats || costs;
+		long long begin = timed ? Stats::now() : 0;
+		(transformer->*transform_batch)(items[i]->opcode, vals.data(), vals.size());
+		long long per_item = timed ? (Stats::now() - begin) / group.size() : 0;
+		int op = items[i]->opcode - 'A';
+		if (stats && op >= 0 && op < STATS_OPCODES)
+			stats->transform[op].record(per_item, group.size());
+		if (costs)
+			costs->record(items[i]->opcode, per_item);
+
+		for (int k = 0; k < (int)group.size(); k++) {
+			if (cache)
+				cache->insert(stage, items[i]->opcode, items[group[k]]->val, vals[k]);
+			items[group[k]]->val = vals[k];
+		}
+	}
+}
+
+#endif // BATCH_TRANSFORM_HPP
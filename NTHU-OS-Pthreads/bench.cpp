@@ -0,0 +1,147 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
+#include "item_pool.hpp"
+#include "reader.hpp"
+#include "writer.hpp"
+#include "producer.hpp"
+#include "consumer_controller.hpp"
+#include "executor.hpp"
+#include "placement.hpp"
+
+// Times the pipeline from the first read to the last write in the split,
+// fused and work-stealing modes of main, with main's default sizes.
+// usage: ./bench <n> <input> <output> <rounds> [split|fused|stealing[@compact|@spread]]...
+// a mode with @compact or @spread pins the threads with that placement policy,
+// prints one "mode,round,seconds,items_per_second" line per run
+
+#define READER_QUEUE_SIZE 200
+#define WORKER_QUEUE_SIZE 200
+#define WRITER_QUEUE_SIZE 4000
+#define BATCH_SIZE 8
+#define PRODUCERS 4
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the stages of a run are shut down and freed after it is timed,
+// closing every queue once the stages feeding it are done as main does
+static double run(std::string mode, int n, std::string input_file, std::string output_file) {
+	ItemQueue* q1 = new ItemQueue(READER_QUEUE_SIZE);
+	WorkerQueue* q2 = new WorkerQueue(WORKER_QUEUE_SIZE);
+	ItemQueue* q3 = new ItemQueue(WRITER_QUEUE_SIZE);
+	ItemPool* pool = new ItemPool(READER_QUEUE_SIZE + WORKER_QUEUE_SIZE + WRITER_QUEUE_SIZE);
+	Transformer* transformer = new Transformer;
+
+	std::string policy = mode.find('@') == std::string::npos ? "" : mode.substr(mode.find('@') + 1);
+	mode = mode.substr(0, mode.find('@'));
+	Placement placement(policy == "compact" ? PLACEMENT_COMPACT : policy == "spread" ? PLACEMENT_SPREAD : PLACEMENT_NONE);
+
+	Reader* reader = new Reader(n, input_file, q1, BATCH_SIZE, pool);
+	reader->set_affinity(placement.next());
+
+	std::vector<Producer*> producers;
+	ConsumerController* cc = nullptr;
+	Executor* executor = nullptr;
+	if (mode == "stealing") {
+		int workers = sysconf(_SC_NPROCESSORS_ONLN);
+		executor = new Executor(q1, q3, transformer, workers, BATCH_SIZE);
+		std::vector<std::vector<int>> cpus;
+		for (int i = 0; i < workers; i++)
+			cpus.push_back(placement.next());
+		executor->set_affinity(cpus);
+	} else {
+		bool fused = mode == "fused";
+		std::vector<std::vector<int>> consumer_cpus;
+		for (int i = 0; i < PRODUCERS; i++) {
+			Producer* producer;
+			if (fused)
+				producer = new Producer(q1, q2, q3, transformer, READER_QUEUE_SIZE / 2, BATCH_SIZE);
+			else
+				producer = new Producer(q1, q2, transformer, BATCH_SIZE);
+			std::vector<int> cpus = placement.next();
+			producer->set_affinity(cpus);
+			if (!cpus.empty())
+				consumer_cpus.push_back(placement.llc_of(cpus[0]));
+			producers.push_back(producer);
+		}
+		cc = new ConsumerController(q2, q3, transformer, 100000,
+			WORKER_QUEUE_SIZE * 20 / 100, WORKER_QUEUE_SIZE * 80 / 100, BATCH_SIZE, 1, 16, 300000);
+		cc->set_consumer_affinity(consumer_cpus);
+		// stdout is for the CSV
+		cc->set_log(stderr);
+	}
+
+	Writer* writer = new Writer(n, output_file, q3, BATCH_SIZE, pool);
+	writer->set_affinity(placement.next());
+
+	double begin = now();
+	reader->start();
+	writer->start();
+	if (executor)
+		executor->start();
+	if (cc)
+		cc->start();
+	for (Producer* producer : producers)
+		producer->start();
+
+	reader->join();
+	writer->join();
+	double seconds = now() - begin;
+
+	q1->close();
+	for (Producer* producer : producers)
+		producer->join();
+	if (executor)
+		executor->join();
+	q2->close();
+	if (cc)
+		cc->join();
+	q3->close();
+
+	for (Producer* producer : producers)
+		delete producer;
+	delete cc;
+	delete executor;
+	delete writer;
+	delete reader;
+	delete transformer;
+	delete pool;
+	delete q3;
+	delete q2;
+	delete q1;
+	return seconds;
+}
+
+int main(int argc, char** argv) {
+	assert(argc >= 5);
+
+	int n = atoi(argv[1]);
+	std::string input_file_name(argv[2]);
+	std::string output_file_name(argv[3]);
+	int rounds = atoi(argv[4]);
+
+	std::vector<std::string> modes(argv + 5, argv + argc);
+	if (modes.empty())
+		modes = {"split", "fused", "stealing"};
+
+	for (int round = 0; round < rounds; round++) {
+		for (const std::string& mode : modes) {
+			double seconds = run(mode, n, input_file_name, output_file_name);
+			printf("%s,%d,%.6f,%.0f\n", mode.c_str(), round, seconds, n / seconds);
+			fflush(stdout);
+		}
+	}
+
+	return 0;
+}
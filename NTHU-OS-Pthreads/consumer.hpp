@@ -1,18 +1,28 @@
 #include <pthread.h>
 #include <stdio.h>
 
+#include <atomic>
+#include <vector>
+
 #include "item.hpp"
 #include "thread.hpp"
 #include "transformer.hpp"
-#include "ts_queue.hpp"
+#include "batch_transform.hpp"
+#include "stats.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
+#include "futex.hpp"
+#include "transform_cache.hpp"
 
 #ifndef CONSUMER_HPP
 #define CONSUMER_HPP
 
+// A Consumer leaves once the worker queue is closed and drained,
+// a parked one has to be unparked first.
 class Consumer : public Thread {
    public:
     // constructor
-    Consumer(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer);
+    Consumer(WorkerQueue* worker_queue, ItemQueue* output_queue, Transformer* transformer, int batch_size = 1);
 
     // destructor
     ~Consumer();
@@ -21,52 +31,106 @@ class Consumer : public Thread {
 
     virtual int cancel() override;
 
+    // stop taking items after the current batch and sleep until unpark
+    void park();
+
+    // resume taking items
+    void unpark();
+
    private:
-    TSQueue<Item*>* worker_queue;
-    TSQueue<Item*>* output_queue;
+    WorkerQueue* worker_queue;
+    ItemQueue* output_queue;
 
     Transformer* transformer;
 
-    bool is_cancel;
+    // the maximum number of items taken from the worker queue at once
+    int batch_size;
+
+    std::atomic<bool> is_cancel;
+
+    // futex word, 1 while the consumer takes items and 0 while it is parked
+    std::atomic<int> running;
 
     // the method for pthread to create a consumer thread
     static void* process(void* arg);
 };
 
-Consumer::Consumer(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer)
-    : worker_queue(worker_queue), output_queue(output_queue), transformer(transformer) {
-    is_cancel = false;
+Consumer::Consumer(WorkerQueue* worker_queue, ItemQueue* output_queue, Transformer* transformer, int batch_size)
+    : worker_queue(worker_queue), output_queue(output_queue), transformer(transformer), batch_size(batch_size),
+      is_cancel(false), running(1) {
 }
 
 Consumer::~Consumer() {}
 
 void Consumer::start() {
     // TODO: starts a Consumer thread
-    pthread_create(&t, 0, Consumer::process, (void*)this);
+    create(Consumer::process, (void*)this);
 }
 
 int Consumer::cancel() {
     // TODO: cancels the consumer thread
-    return is_cancel = !pthread_cancel(t);
+    // the thread never acts on the request, it leaves its loop on is_cancel
+    // and deletes itself, so this must not be touched after setting it
+    bool cancelled = !pthread_cancel(t);
+    if (cancelled) {
+        unpark();
+        is_cancel = true;
+    }
+    return cancelled;
+}
+
+void Consumer::park() {
+    running.store(0);
+}
+
+void Consumer::unpark() {
+    running.store(1);
+    futex_wake(&running, 1);
 }
 
 void* Consumer::process(void* arg) {
     Consumer* consumer = (Consumer*)arg;
 
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, nullptr);
+    // a consumer is only stopped between batches, through is_cancel
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+
+    std::vector<Item*> batch(consumer->batch_size);
+    Stats::Recorder* stats = Stats::recorder("consumer");
+    CostModel* costs = cost_model_of(consumer->worker_queue);
+    TransformCache* cache = TransformCache::instance();
+    long long begin = 0;
 
     while (!consumer->is_cancel) {
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+        if (!consumer->running.load()) {
+            futex_wait(&consumer->running, 0);
+            continue;
+        }
 
         // TODO: implements the Consumer's work
-        Item* item = consumer->worker_queue->dequeue();
-        item->val = consumer->transformer->consumer_transform(item->opcode, item->val);
-        consumer->output_queue->enqueue(item);
-
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+        if (stats)
+            begin = Stats::now();
+        int n = consumer->worker_queue->dequeue_bulk(batch.data(), consumer->batch_size);
+        if (n == 0)  // the worker queue is closed and drained
+            break;
+        if (stats)
+            stats->dequeue_wait.record(Stats::now() - begin);
+        transform_items(consumer->transformer, &Transformer::consumer_transform_batch, batch.data(), n, stats,
+            costs, cache);
+
+        if (stats)
+            begin = Stats::now();
+        consumer->output_queue->enqueue_bulk(batch.data(), n);
+        if (stats) {
+            long long end = Stats::now();
+            stats->enqueue_wait.record(end - begin);
+            stats->handled(n, end);
+        }
     }
 
-    delete consumer;
+    // a cancelled consumer is forgotten by its controller, otherwise the
+    // controller joins and deletes it
+    if (consumer->is_cancel)
+        delete consumer;
 
     return nullptr;
 }
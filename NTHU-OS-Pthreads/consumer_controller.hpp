@@ -1,4 +1,6 @@
 #include <pthread.h>
+#include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <iostream>
@@ -7,45 +9,72 @@
 #include "consumer.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
+#include "stats.hpp"
+#include "scaling_policy.hpp"
 
 #ifndef CONSUMER_CONTROLLER
 #define CONSUMER_CONTROLLER
 
+// The controller runs until the worker queue is closed, then waits for its
+// consumers to drain it, so joining it means the consumers are done.
 class ConsumerController : public Thread {
    public:
     // constructor
     ConsumerController(
-        TSQueue<Item*>* worker_queue,
-        TSQueue<Item*>* writer_queue,
+        WorkerQueue* worker_queue,
+        ItemQueue* writer_queue,
         Transformer* transformer,
         int check_period,
         int low_threshold,
-        int high_threshold);
+        int high_threshold,
+        int batch_size = 1,
+        int min_consumers = 1,
+        int max_consumers = 16,
+        int cooldown_period = 0);
 
     // destructor
     ~ConsumerController();
 
     virtual void start();
 
+    // run consumer i only on cpus[i % cpus.size()], set before start
+    void set_consumer_affinity(std::vector<std::vector<int>> cpus);
+
+    // print the scaling actions to log instead of stdout, set before start
+    void set_log(FILE* log);
+
    private:
+    // max_consumers consumers spawned up front, the first active of them
+    // take items and the rest are parked
     std::vector<Consumer*> consumers;
+    int active;
+    // the cpus of each consumer, all when empty
+    std::vector<std::vector<int>> consumer_cpus;
 
-    TSQueue<Item*>* worker_queue;
-    TSQueue<Item*>* writer_queue;
+    WorkerQueue* worker_queue;
+    ItemQueue* writer_queue;
 
     Transformer* transformer;
 
     // Check to scale down or scale up every check period in microseconds.
     int check_period;
-    // When the number of items in the worker queue is lower than low_threshold,
-    // the number of consumers scaled down by 1.
-    int low_threshold;
-    // When the number of items in the worker queue is higher than high_threshold,
-    // the number of consumers scaled up by 1.
-    int high_threshold;
-    // Use to log the time of action
-    long long int time_stamp;
+    // The batch size given to every consumer.
+    int batch_size;
+    // The bounds of the number of consumers.
+    int min_consumers;
+    int max_consumers;
+    // decides when to scale and by how much, see ScalingPolicy
+    ScalingPolicy policy;
+    // where the scaling actions are printed
+    FILE* log;
+
+    // unpark or park consumers until target of them are active
+    void scale(int target);
+
+    // the monotonic time in microseconds
+    static long long now();
 
     static void* process(void* arg);
 };
@@ -53,47 +82,99 @@ class ConsumerController : public Thread {
 // Implementation start
 
 ConsumerController::ConsumerController(
-    TSQueue<Item*>* worker_queue,
-    TSQueue<Item*>* writer_queue,
+    WorkerQueue* worker_queue,
+    ItemQueue* writer_queue,
     Transformer* transformer,
     int check_period,
     int low_threshold,
-    int high_threshold) : worker_queue(worker_queue),
+    int high_threshold,
+    int batch_size,
+    int min_consumers,
+    int max_consumers,
+    int cooldown_period) : active(0),
+                          worker_queue(worker_queue),
                           writer_queue(writer_queue),
                           transformer(transformer),
                           check_period(check_period),
-                          low_threshold(low_threshold),
-                          high_threshold(high_threshold) {
+                          batch_size(batch_size),
+                          min_consumers(min_consumers),
+                          max_consumers(max_consumers),
+                          policy(low_threshold, high_threshold, min_consumers, max_consumers, cooldown_period),
+                          log(stdout) {
 }
 
 ConsumerController::~ConsumerController() {}
 
 void ConsumerController::start() {
     // TODO: starts a ConsumerController thread
-    pthread_create(&t, 0, ConsumerController::process, (void*)this);
-    time_stamp = 0;
+    create(ConsumerController::process, (void*)this);
+}
+
+void ConsumerController::set_consumer_affinity(std::vector<std::vector<int>> cpus) {
+    consumer_cpus = cpus;
+}
+
+void ConsumerController::set_log(FILE* log) {
+    this->log = log;
+}
+
+void ConsumerController::scale(int target) {
+    int size = active;
+    if (target > max_consumers)
+        target = max_consumers;
+    if (target < min_consumers)
+        target = min_consumers;
+    if (target == size)
+        return;
+
+    while (active < target)
+        consumers[active++]->unpark();
+    while (active > target)
+        consumers[--active]->park();
+    fprintf(log, "Scaling %s consumers from %d to %d\n", target > size ? "up" : "down", size, target);
+    Stats::event("consumers", target);
+}
+
+long long ConsumerController::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
 void* ConsumerController::process(void* arg) {
     // TODO: implements the ConsumerController's work
     ConsumerController* cc = (ConsumerController*)arg;  // consumer controller
 
-    while (true) {
-        if (cc->worker_queue->get_size() > cc->high_threshold) {
-            Consumer* consumer = new Consumer(cc->worker_queue, cc->writer_queue, cc->transformer);
-            cc->consumers.push_back(consumer);
-            consumer->start();
-            printf("Scaling up consumers from %d to %d\n", cc->consumers.size() - 1, cc->consumers.size());
-        }
-
-        if (cc->worker_queue->get_size() < cc->low_threshold && cc->consumers.size() > 1) {  // at least one consumer
-            cc->consumers.back()->cancel();
-            cc->consumers.pop_back();
-            printf("Scaling down consumers from %d to %d\n", cc->consumers.size() + 1, cc->consumers.size());
-        }
-
-        sleep(cc->check_period / 1000000);
+    for (int i = 0; i < cc->max_consumers; i++) {
+        Consumer* consumer = new Consumer(cc->worker_queue, cc->writer_queue, cc->transformer, cc->batch_size);
+        consumer->park();
+        if (!cc->consumer_cpus.empty())
+            consumer->set_affinity(cc->consumer_cpus[i % cc->consumer_cpus.size()]);
+        consumer->start();
+        cc->consumers.push_back(consumer);
+    }
+    cc->scale(cc->policy.start(now()));
+
+    struct timespec period;
+    period.tv_sec = cc->check_period / 1000000;
+    period.tv_nsec = cc->check_period % 1000000 * 1000L;
+
+    while (!cc->worker_queue->is_closed()) {
+        int sample = cc->worker_queue->get_size();
+        Stats::event("worker_queue_depth", sample);
+        cc->scale(cc->policy.next(cc->active, sample, now()));
+
+        nanosleep(&period, nullptr);
+    }
+
+    // let every consumer drain the worker queue and leave
+    for (Consumer* consumer : cc->consumers)
+        consumer->unpark();
+    for (Consumer* consumer : cc->consumers) {
+        consumer->join();
+        delete consumer;
     }
+    cc->consumers.clear();
 
     return nullptr;
 }
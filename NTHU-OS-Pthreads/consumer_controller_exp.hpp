@@ -7,7 +7,8 @@
 #include "consumer.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
 
 #ifndef CONSUMER_CONTROLLER_TEST
 #define CONSUMER_CONTROLLER_TEST
@@ -16,8 +17,8 @@ class ConsumerControllerTest : public Thread {
    public:
     // constructor
     ConsumerControllerTest(
-        TSQueue<Item*>* worker_queue,
-        TSQueue<Item*>* writer_queue,
+        WorkerQueue* worker_queue,
+        ItemQueue* writer_queue,
         Transformer* transformer,
         int check_period,
         int low_threshold,
@@ -41,8 +42,8 @@ class ConsumerControllerTest : public Thread {
    private:
     std::vector<Consumer*> consumers;
 
-    TSQueue<Item*>* worker_queue;
-    TSQueue<Item*>* writer_queue;
+    WorkerQueue* worker_queue;
+    ItemQueue* writer_queue;
 
     Transformer* transformer;
 
@@ -63,8 +64,8 @@ class ConsumerControllerTest : public Thread {
 // Implementation start
 
 ConsumerControllerTest::ConsumerControllerTest(
-    TSQueue<Item*>* worker_queue,
-    TSQueue<Item*>* writer_queue,
+    WorkerQueue* worker_queue,
+    ItemQueue* writer_queue,
     Transformer* transformer,
     int check_period,
     int low_threshold,
@@ -80,7 +81,7 @@ ConsumerControllerTest::~ConsumerControllerTest() {}
 
 void ConsumerControllerTest::start() {
     // TODO: starts a ConsumerControllerTest thread
-    pthread_create(&t, 0, ConsumerControllerTest::process, (void*)this);
+    create(ConsumerControllerTest::process, (void*)this);
     time_stamp = 0;
 }
 
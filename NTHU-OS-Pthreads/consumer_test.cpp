@@ -1,18 +1,21 @@
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
 #include "consumer.hpp"
 
 int main() {
-	TSQueue<Item*>* q1;
-	TSQueue<Item*>* q2;
+	ItemQueue* q0;
+	WorkerQueue* q1;
+	ItemQueue* q2;
 
-	q1 = new TSQueue<Item*>;
-	q2 = new TSQueue<Item*>;
+	q0 = new ItemQueue;
+	q1 = new WorkerQueue;
+	q2 = new ItemQueue;
 
 	Transformer* transformer = new Transformer;
 
-	Reader* reader = new Reader(80, "./tests/00.in", q1);
+	Reader* reader = new Reader(80, "./tests/00.in", q0);
 	Writer* writer = new Writer(80, "./tests/00.out", q2);
 
 	Consumer* p1 = new Consumer(q1, q2, transformer);
@@ -28,8 +31,18 @@ int main() {
 	p3->start();
 	p4->start();
 
+	// the reader takes a plain ItemQueue, the worker queue may be an OpcodeQueue
+	for (int i = 0; i < 80; i++)
+		q1->enqueue(q0->dequeue());
+
 	reader->join();
 	writer->join();
+	// the stages leave once their input is closed and drained
+	q1->close();
+	p1->join();
+	p2->join();
+	p3->join();
+	p4->join();
 	
 	delete p2;
 	delete p1;
@@ -38,6 +51,7 @@ int main() {
 	delete transformer;
 	delete q2;
 	delete q1;
+	delete q0;
 
 	return 0;
 }
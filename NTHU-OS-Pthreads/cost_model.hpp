@@ -0,0 +1,59 @@
+#include <atomic>
+
+#ifndef COST_MODEL_HPP
+#define COST_MODEL_HPP
+
+// the opcodes with their own cost, 'A' to 'Z', every other opcode shares the
+// last class
+#define COST_MODEL_CLASSES 27
+
+// the weight of a new sample in the moving average, as 1 / 2^shift
+#define COST_MODEL_EWMA_SHIFT 3
+
+// The transform time per item of each opcode, learned at runtime as an
+// exponentially weighted moving average of the times the workers measure.
+// Updates from several threads may overwrite each other, which only drops a
+// sample.
+class CostModel {
+public:
+	// constructor
+	CostModel();
+
+	// the class of an opcode
+	static int class_of(char opcode);
+
+	// count a measured time per item of ns for opcode
+	void record(char opcode, long long ns);
+
+	// the expected time per item of class c in ns, 0 until it is measured
+	long long get_cost(int c);
+private:
+	std::atomic<long long> costs[COST_MODEL_CLASSES];
+};
+
+// Implementation start
+
+CostModel::CostModel() {
+	for (int c = 0; c < COST_MODEL_CLASSES; c++)
+		costs[c].store(0, std::memory_order_relaxed);
+}
+
+int CostModel::class_of(char opcode) {
+	if (opcode >= 'A' && opcode <= 'Z')
+		return opcode - 'A';
+	return COST_MODEL_CLASSES - 1;
+}
+
+void CostModel::record(char opcode, long long ns) {
+	std::atomic<long long>& cost = costs[class_of(opcode)];
+	long long old = cost.load(std::memory_order_relaxed);
+	// the first sample replaces the unknown cost, which is the only 0
+	long long next = old == 0 ? ns : old + ((ns - old) >> COST_MODEL_EWMA_SHIFT);
+	cost.store(next > 0 ? next : 1, std::memory_order_relaxed);
+}
+
+long long CostModel::get_cost(int c) {
+	return costs[c].load(std::memory_order_relaxed);
+}
+
+#endif // COST_MODEL_HPP
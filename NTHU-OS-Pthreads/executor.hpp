@@ -0,0 +1,341 @@
+#include <pthread.h>
+#include <sched.h>
+#include <limits.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "futex.hpp"
+#include "thread.hpp"
+#include "item_queue.hpp"
+#include "item.hpp"
+#include "transformer.hpp"
+#include "batch_transform.hpp"
+#include "work_deque.hpp"
+#include "stats.hpp"
+
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+// the number of rounds an idle worker retries stealing before it parks
+#define EXECUTOR_IDLE_ROUNDS 64
+
+// A pool of workers running both transforms of every item, in place of the
+// Producers, the worker queue and the Consumers.
+// Each worker owns a deque of tasks, a task being an item tagged with the
+// transform it needs next. A worker takes items from the input queue only
+// when its deque is empty and steals from the others when the input queue
+// is empty too, so every worker stays busy whatever the cost of either
+// transform.
+// An idle worker parks: one of them at a time blocks on the input queue, the
+// others on an eventcount bumped when a deque gets tasks, the input queue
+// gets a free watcher or the input ends. While workers are parked, an owner
+// pops only half of its deque and leaves the rest to be stolen. The workers
+// leave once the input queue is closed and drained and every deque is empty.
+class Executor {
+public:
+	// constructor
+	Executor(ItemQueue* input_queue, ItemQueue* output_queue, Transformer* transformer, int workers,
+		int batch_size = 1);
+
+	// destructor
+	~Executor();
+
+	// starts the workers
+	void start();
+
+	// waits for the workers, which leave once the input queue is closed
+	// and drained
+	void join();
+
+	// run worker i only on cpus[i % cpus.size()], set before start
+	void set_affinity(std::vector<std::vector<int>> cpus);
+private:
+	// an item, with the low bit set once its producer transform is done
+	typedef uintptr_t Task;
+
+	class Worker : public Thread {
+	public:
+		// constructor
+		Worker(Executor* executor, int id);
+
+		virtual void start() override;
+	private:
+		// take up to max tasks from the own deque, the input queue or
+		// another worker, in this order, without blocking
+		int take(Task* tasks, int max);
+
+		// take up to max tasks from the other workers
+		int steal(Task* tasks, int max);
+
+		// park until there are tasks to take, returns how many were taken,
+		// 0 once there is no work left
+		int wait(Task* tasks, int max);
+
+		// whether the input is done and every deque is empty
+		bool drained();
+
+		// run one transform on each task, the produced items go back to the
+		// own deque and the consumed ones to the output queue
+		void run(Task* tasks, int n);
+
+		Executor* executor;
+		int id;
+
+		WorkDeque<Task> deque;
+
+		// xorshift state choosing the first victim to steal from
+		unsigned int seed;
+
+		// the recorder of the worker thread, nullptr when stats are off
+		Stats::Recorder* stats;
+
+		// scratch space for run
+		std::vector<Item*> items;
+		std::vector<Item*> produced;
+		std::vector<Item*> consumed;
+
+		// the method for pthread to create a worker thread
+		static void* process(void* arg);
+	};
+
+	ItemQueue* input_queue;
+	ItemQueue* output_queue;
+
+	Transformer* transformer;
+
+	// the maximum number of tasks a worker runs at once
+	int batch_size;
+
+	std::vector<Worker*> workers;
+
+	// whether an idle worker is blocked on the input queue
+	std::atomic<bool> watching;
+	// whether the input queue was found closed and drained
+	std::atomic<bool> input_done;
+	// the futex word the other idle workers park on, and the number of them
+	std::atomic<int> event;
+	std::atomic<int> parked;
+
+	// bump the event and wake up to n parked workers, only if there are any
+	void notify(int n);
+};
+
+// Implementation start
+
+Executor::Executor(ItemQueue* input_queue, ItemQueue* output_queue, Transformer* transformer, int workers,
+	int batch_size)
+	: input_queue(input_queue), output_queue(output_queue), transformer(transformer), batch_size(batch_size),
+	  watching(false), input_done(false), event(0), parked(0) {
+	for (int i = 0; i < workers; i++)
+		this->workers.push_back(new Worker(this, i));
+}
+
+Executor::~Executor() {
+	for (Worker* worker : workers)
+		delete worker;
+}
+
+void Executor::start() {
+	for (Worker* worker : workers)
+		worker->start();
+}
+
+void Executor::join() {
+	for (Worker* worker : workers)
+		worker->join();
+}
+
+void Executor::set_affinity(std::vector<std::vector<int>> cpus) {
+	if (cpus.empty())
+		return;
+	for (int i = 0; i < (int)workers.size(); i++)
+		workers[i]->Thread::set_affinity(cpus[i % cpus.size()]);
+}
+
+void Executor::notify(int n) {
+	// orders the tasks published before against the load of parked,
+	// pairing with the increment a worker does before its last try
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (parked.load(std::memory_order_relaxed) > 0) {
+		event++;
+		futex_wake(&event, n);
+	}
+}
+
+// a deque never holds more than one batch: it is refilled only when empty
+// and every run pushes back at most what it popped
+static int deque_capacity(int batch_size) {
+	int capacity = 1;
+	while (capacity < batch_size)
+		capacity <<= 1;
+	return capacity;
+}
+
+Executor::Worker::Worker(Executor* executor, int id)
+	: executor(executor), id(id), deque(deque_capacity(executor->batch_size)), seed(id * 2654435761U + 1),
+	  stats(nullptr), items(executor->batch_size) {
+	produced.reserve(executor->batch_size);
+	consumed.reserve(executor->batch_size);
+}
+
+void Executor::Worker::start() {
+	create(Executor::Worker::process, (void*)this);
+}
+
+int Executor::Worker::take(Task* tasks, int max) {
+	// leave half of the deque to the parked workers woken up for it
+	int own = executor->parked.load(std::memory_order_relaxed) > 0 ? (deque.get_size() + 1) / 2 : max;
+	int n = 0;
+	while (n < own && n < max && deque.pop(tasks[n]))
+		n++;
+	if (n > 0)
+		return n;
+
+	n = executor->input_queue->try_dequeue_bulk(items.data(), max);
+	for (int i = 0; i < n; i++)
+		tasks[i] = (Task)items[i];
+	if (n > 0)
+		return n;
+
+	return steal(tasks, max);
+}
+
+int Executor::Worker::steal(Task* tasks, int max) {
+	int workers = executor->workers.size();
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	for (int i = 0; i < workers; i++) {
+		Worker* victim = executor->workers[(seed + i) % workers];
+		if (victim == this)
+			continue;
+
+		// take half of what the victim has so both keep working
+		int want = (victim->deque.get_size() + 1) / 2;
+		int n = 0;
+		while (n < want && n < max && victim->deque.steal(tasks[n]))
+			n++;
+		if (n > 0)
+			return n;
+	}
+	return 0;
+}
+
+void Executor::Worker::run(Task* tasks, int n) {
+	produced.clear();
+	consumed.clear();
+	for (int i = 0; i < n; i++) {
+		Item* item = (Item*)(tasks[i] & ~(Task)1);
+		if (tasks[i] & 1)
+			consumed.push_back(item);
+		else
+			produced.push_back(item);
+	}
+
+	transform_items(executor->transformer, &Transformer::producer_transform_batch, produced.data(),
+		produced.size(), stats);
+	int pushed = 0;
+	for (Item* item : produced) {
+		if (deque.push((Task)item | 1))
+			pushed++;
+		else
+			consumed.push_back(item);
+	}
+	// a parked worker may steal half of them
+	if (pushed > 1)
+		executor->notify(1);
+
+	transform_items(executor->transformer, &Transformer::consumer_transform_batch, consumed.data(),
+		consumed.size(), stats);
+	long long begin = stats ? Stats::now() : 0;
+	executor->output_queue->enqueue_bulk(consumed.data(), consumed.size());
+	if (stats) {
+		long long end = Stats::now();
+		stats->enqueue_wait.record(end - begin);
+		stats->handled(consumed.size(), end);
+	}
+}
+
+int Executor::Worker::wait(Task* tasks, int max) {
+	while (true) {
+		bool watching = false;
+		if (!executor->input_done.load() && executor->watching.compare_exchange_strong(watching, true)) {
+			int n = executor->input_queue->dequeue_bulk(items.data(), max);
+			if (n == 0)
+				executor->input_done.store(true);
+			executor->watching.store(false);
+			// another worker takes over the watch, or all of them check
+			// whether the work is done
+			executor->notify(n > 0 ? 1 : INT_MAX);
+			for (int i = 0; i < n; i++)
+				tasks[i] = (Task)items[i];
+			if (n > 0)
+				return n;
+		}
+
+		int seen = executor->event.load();
+		executor->parked++;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int n = take(tasks, max);
+		bool done = n == 0 && drained();
+		bool watch = n == 0 && !executor->input_done.load() && !executor->watching.load();
+		if (n == 0 && !done && !watch)
+			futex_wait(&executor->event, seen);
+		executor->parked--;
+		if (n > 0)
+			return n;
+		if (done) {
+			// the others may be parked on a deque this worker saw empty
+			executor->notify(INT_MAX);
+			return 0;
+		}
+		n = take(tasks, max);
+		if (n > 0)
+			return n;
+	}
+}
+
+bool Executor::Worker::drained() {
+	if (!executor->input_done.load())
+		return false;
+	for (Worker* worker : executor->workers) {
+		if (worker->deque.get_size() > 0)
+			return false;
+	}
+	return true;
+}
+
+void* Executor::Worker::process(void* arg) {
+	Worker* worker = (Worker*)arg;
+	Executor* executor = worker->executor;
+
+	std::vector<Task> tasks(executor->batch_size);
+	int idle = 0;
+	worker->stats = Stats::recorder("executor_worker");
+
+	while (true) {
+		int n = worker->take(tasks.data(), executor->batch_size);
+		if (n == 0 && ++idle < EXECUTOR_IDLE_ROUNDS) {
+			sched_yield();
+			continue;
+		}
+		if (n == 0) {
+			// nothing to steal either, park until there is
+			long long begin = worker->stats ? Stats::now() : 0;
+			n = worker->wait(tasks.data(), executor->batch_size);
+			if (worker->stats)
+				worker->stats->dequeue_wait.record(Stats::now() - begin);
+			// the input queue is closed and drained, and so is every deque
+			if (n == 0)
+				break;
+		}
+		idle = 0;
+
+		worker->run(tasks.data(), n);
+	}
+
+	return nullptr;
+}
+
+#endif // EXECUTOR_HPP
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
 #include "item.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
@@ -23,13 +24,13 @@ int main(int argc, char** argv) {
 	int CONSUMER_CONTROLLER_CHECK_PERIOD = atoi(argv[9]);
 	
 	// TODO: implements main function
-	TSQueue<Item*>* q1;
-	TSQueue<Item*>* q2;
-	TSQueue<Item*>* q3;
+	ItemQueue* q1;
+	WorkerQueue* q2;
+	ItemQueue* q3;
 
-	q1 = new TSQueue<Item*>(READER_QUEUE_SIZE); // Input Queue
-	q2 = new TSQueue<Item*>(WORKER_QUEUE_SIZE); // Worker Queue
-	q3 = new TSQueue<Item*>(WRITER_QUEUE_SIZE); // Writer Queue
+	q1 = new ItemQueue(READER_QUEUE_SIZE); // Input Queue
+	q2 = new WorkerQueue(WORKER_QUEUE_SIZE); // Worker Queue
+	q3 = new ItemQueue(WRITER_QUEUE_SIZE); // Writer Queue
 
 	Transformer* transformer = new Transformer;
 
@@ -0,0 +1,19 @@
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+
+#ifndef FUTEX_HPP
+#define FUTEX_HPP
+
+// block while *addr == val, may return spuriously
+inline void futex_wait(std::atomic<int>* addr, int val) {
+	syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+// wake up to n threads blocked on addr
+inline void futex_wake(std::atomic<int>* addr, int n) {
+	syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+#endif // FUTEX_HPP
@@ -7,7 +7,8 @@ class Item {
 public:
 	Item();
 	explicit Item(int key, unsigned long long val, char opcode);
-	~Item();
+	// trivial, so Items can be copied with memcpy, e.g. into shared memory
+	~Item() = default;
 
 	friend std::ostream& operator<<(std::ostream& os, const Item& item);
 	friend std::istream& operator>>(std::istream& in, Item& item);
@@ -15,18 +16,20 @@ public:
 	int key;
 	unsigned long long val;
 	char opcode;
+	// the position of the item in the input, set by the reader
+	long long seq;
+	// the slot of the service job the item belongs to, set by the reader
+	int job;
 };
 
 // Implementation start
 
-Item::Item() {}
+Item::Item() : seq(0), job(0) {}
 
 Item::Item(int key, unsigned long long val, char opcode) :
-	key(key), val(val), opcode(opcode) {
+	key(key), val(val), opcode(opcode), seq(0), job(0) {
 }
 
-Item::~Item() {}
-
 std::istream& operator>>(std::istream& in, Item& item) {
 	in >> item.key >> item.val >> item.opcode;
 	return in;
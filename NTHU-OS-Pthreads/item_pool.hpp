@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <vector>
+#include "item.hpp"
+
+#ifndef ITEM_POOL_HPP
+#define ITEM_POOL_HPP
+
+// the number of items a cache moves from / to the shared free list at once
+#define ITEM_POOL_CACHE_SIZE 32
+
+// A fixed set of Items allocated up front.
+// The Reader takes items from the pool and the Writer gives them back after
+// output, so memory stays bounded by the pool capacity whatever the input
+// length. When every item is in flight, taking one blocks until the Writer
+// returns some.
+class ItemPool {
+public:
+	// A per-thread cache in front of the shared free list,
+	// each thread owns its own cache and a cache is not thread safe.
+	class Cache {
+	public:
+		// constructor
+		explicit Cache(ItemPool* pool);
+
+		// destructor, gives the cached items back to the pool
+		~Cache();
+
+		// take an item, blocks until one is available
+		Item* acquire();
+
+		// take an item, returns nullptr instead of blocking
+		Item* try_acquire();
+
+		// give an item back
+		void release(Item* item);
+
+		// give all cached items back to the shared free list
+		void flush();
+	private:
+		ItemPool* pool;
+		std::vector<Item*> items;
+	};
+
+	// constructor
+	explicit ItemPool(int capacity);
+
+	// destructor
+	~ItemPool();
+
+	// return the total number of items owned by the pool
+	int get_capacity();
+private:
+	// move up to n items from the free list to out,
+	// blocks until there is at least one when wait is set
+	void take(std::vector<Item*>& out, int n, bool wait);
+
+	// move all items of in to the free list
+	void give(std::vector<Item*>& in);
+
+	int capacity;
+	// the items owned by the pool
+	Item* storage;
+	// the items not taken by any cache
+	std::vector<Item*> free_list;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_available;
+};
+
+// Implementation start
+
+ItemPool::ItemPool(int capacity) : capacity(capacity) {
+	storage = new Item [capacity];
+	free_list.reserve(capacity);
+	for (int i = 0; i < capacity; i++)
+		free_list.push_back(&storage[i]);
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_available, NULL);
+}
+
+ItemPool::~ItemPool() {
+	delete [] storage;
+	pthread_cond_destroy(&cond_available);
+	pthread_mutex_destroy(&mutex);
+}
+
+int ItemPool::get_capacity() {
+	return capacity;
+}
+
+void ItemPool::take(std::vector<Item*>& out, int n, bool wait) {
+	pthread_mutex_lock(&mutex);
+	while (wait && free_list.empty())
+		pthread_cond_wait(&cond_available, &mutex);
+	while (n-- && !free_list.empty()) {
+		out.push_back(free_list.back());
+		free_list.pop_back();
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void ItemPool::give(std::vector<Item*>& in) {
+	pthread_mutex_lock(&mutex);
+	free_list.insert(free_list.end(), in.begin(), in.end());
+	pthread_cond_broadcast(&cond_available);
+	pthread_mutex_unlock(&mutex);
+	in.clear();
+}
+
+ItemPool::Cache::Cache(ItemPool* pool) : pool(pool) {
+	items.reserve(ITEM_POOL_CACHE_SIZE);
+}
+
+ItemPool::Cache::~Cache() {
+	flush();
+}
+
+Item* ItemPool::Cache::acquire() {
+	if (items.empty())
+		pool->take(items, ITEM_POOL_CACHE_SIZE, true);
+	Item* item = items.back();
+	items.pop_back();
+	return item;
+}
+
+Item* ItemPool::Cache::try_acquire() {
+	if (items.empty())
+		pool->take(items, ITEM_POOL_CACHE_SIZE, false);
+	if (items.empty())
+		return nullptr;
+	Item* item = items.back();
+	items.pop_back();
+	return item;
+}
+
+void ItemPool::Cache::release(Item* item) {
+	items.push_back(item);
+	if (items.size() >= ITEM_POOL_CACHE_SIZE)
+		flush();
+}
+
+void ItemPool::Cache::flush() {
+	if (!items.empty())
+		pool->give(items);
+}
+
+#endif // ITEM_POOL_HPP
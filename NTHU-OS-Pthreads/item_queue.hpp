@@ -0,0 +1,17 @@
+#include "ts_queue.hpp"
+#include "lf_queue.hpp"
+#include "item.hpp"
+
+#ifndef ITEM_QUEUE_HPP
+#define ITEM_QUEUE_HPP
+
+// The queue connecting the pipeline stages.
+// Build with -DTS_QUEUE_LOCK_FREE to use the lock-free ring instead of the
+// mutex/condvar TSQueue.
+#ifdef TS_QUEUE_LOCK_FREE
+typedef LFQueue<Item*> ItemQueue;
+#else
+typedef TSQueue<Item*> ItemQueue;
+#endif
+
+#endif // ITEM_QUEUE_HPP
@@ -0,0 +1,119 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "item.hpp"
+#include "shm_queue.hpp"
+#include "transformer.hpp"
+#include "value_stages.hpp"
+
+// Runs the pipeline as separate processes sharing two ShmQueues: this
+// process reads the input into the input queue and writes the output queue
+// out, while N worker processes apply both transforms in between. A worker is
+// this binary started again in worker mode with the names of the queues,
+// which are unlinked as soon as every worker has opened them, so nothing is
+// left in /dev/shm however the processes end.
+// usage: ./launcher <n> <input> <output> [workers]
+//        ./launcher worker <input queue> <output queue>
+
+#define INPUT_QUEUE_SIZE 200
+#define OUTPUT_QUEUE_SIZE 4000
+#define BATCH_SIZE 16
+#define DEFAULT_WORKERS 4
+// the number of buffered output bytes that triggers a write
+#define FLUSH_THRESHOLD (1 << 16)
+// 1 applies the closed form of each transform instead of iterating
+#ifndef TRANSFORMER_FAST_MODE
+#define TRANSFORMER_FAST_MODE 0
+#endif
+
+typedef ShmQueue<Item> ItemShmQueue;
+
+int main(int argc, char** argv) {
+	if (argc == 4 && std::string(argv[1]) == "worker") {
+		ItemShmQueue input_queue(argv[2]);
+		ItemShmQueue output_queue(argv[3]);
+		Transformer transformer(TRANSFORMER_FAST_MODE);
+		ValueWorker<ItemShmQueue>(&input_queue, &output_queue, &transformer, BATCH_SIZE).run();
+		return 0;
+	}
+	assert(argc == 4 || argc == 5);
+
+	int n = atoi(argv[1]);
+	std::string input_file_name(argv[2]);
+	std::string output_file_name(argv[3]);
+	int workers = argc == 5 ? atoi(argv[4]) : DEFAULT_WORKERS;
+
+	std::string prefix = "/os_mp_" + std::to_string(getpid());
+	std::string input_name = prefix + "_input", output_name = prefix + "_output";
+	ItemShmQueue* input_queue = new ItemShmQueue(input_name, INPUT_QUEUE_SIZE);
+	ItemShmQueue* output_queue = new ItemShmQueue(output_name, OUTPUT_QUEUE_SIZE);
+
+	std::vector<pid_t> pids;
+	auto give_up = [&]() {
+		for (pid_t child : pids) {
+			kill(child, SIGKILL);
+			waitpid(child, nullptr, 0);
+		}
+		input_queue->unlink();
+		output_queue->unlink();
+		return 1;
+	};
+
+	for (int i = 0; i < workers; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return give_up();
+		}
+		if (pid == 0) {
+			execl("/proc/self/exe", argv[0], "worker", input_name.c_str(), output_name.c_str(), (char*)nullptr);
+			_exit(127);
+		}
+		pids.push_back(pid);
+	}
+
+	// unlink the names once every worker has opened the queues, the
+	// processes that opened them keep using them
+	while (input_queue->get_openers() < workers || output_queue->get_openers() < workers) {
+		for (pid_t pid : pids) {
+			if (waitpid(pid, nullptr, WNOHANG) == pid) {
+				fprintf(stderr, "worker %d exited before opening the queues\n", (int)pid);
+				pids.erase(std::find(pids.begin(), pids.end(), pid));
+				return give_up();
+			}
+		}
+		usleep(1000);
+	}
+	input_queue->unlink();
+	output_queue->unlink();
+
+	ValueWriter<ItemShmQueue> writer(n, output_file_name, output_queue, BATCH_SIZE, FLUSH_THRESHOLD);
+	writer.start();
+
+	ValueReader<ItemShmQueue>(n, input_file_name, input_queue, BATCH_SIZE).run();
+	// the workers leave once they drained the input queue
+	input_queue->close();
+
+	bool failed = false;
+	for (pid_t pid : pids) {
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "worker %d failed\n", (int)pid);
+			failed = true;
+		}
+	}
+	output_queue->close();
+	writer.join();
+
+	delete input_queue;
+	delete output_queue;
+
+	return failed ? 1 : 0;
+}
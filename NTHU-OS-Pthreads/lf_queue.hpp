@@ -0,0 +1,292 @@
+#include <limits.h>
+#include <atomic>
+#include "futex.hpp"
+
+#ifndef LF_QUEUE_HPP
+#define LF_QUEUE_HPP
+
+#ifndef DEFAULT_BUFFER_SIZE
+#define DEFAULT_BUFFER_SIZE 200
+#endif
+
+#define CACHE_LINE_SIZE 64
+
+// Lock-free bounded MPMC queue with the same interface as TSQueue.
+// Every slot carries a sequence number telling whether it is ready for the
+// next enqueue or dequeue at that position, so producers and consumers only
+// contend on their own counter. Threads park on a futex only when the queue
+// is full or empty.
+template <class T>
+class LFQueue {
+public:
+	// constructor
+	LFQueue();
+
+	// a single slot cannot tell full from empty, so the capacity is at least 2
+	explicit LFQueue(int max_buffer_size);
+
+	// destructor
+	~LFQueue();
+
+	// add an element to the end of the queue (tail)
+	void enqueue(T item);
+
+	// remove and return the first element of the queue (head),
+	// or T() once the queue is closed and empty
+	T dequeue();
+
+	// add n elements to the end of the queue with one wakeup per run of
+	// successful enqueues
+	void enqueue_bulk(T* items, int n);
+
+	// remove up to max elements from the head of the queue into items,
+	// blocks until at least one is available and returns the number removed,
+	// 0 once the queue is closed and empty
+	int dequeue_bulk(T* items, int max);
+
+	// remove up to max elements from the head of the queue into items
+	// without blocking, returns the number removed which may be 0
+	int try_dequeue_bulk(T* items, int max);
+
+	// return the number of elements in the queue
+	int get_size();
+
+	// return the capacity, which may exceed the one asked for
+	int get_capacity();
+
+	// mark the end of the input, after the last enqueue: the remaining
+	// elements are still dequeued and then every dequeue returns at once
+	void close();
+
+	// return whether close was called
+	bool is_closed();
+private:
+	struct Slot {
+		std::atomic<unsigned long long> seq;
+		T value;
+	};
+
+	typedef std::atomic<unsigned long long> Counter;
+
+	// non-blocking attempts, return false when the queue is full / empty
+	bool try_enqueue(const T& item);
+	bool try_dequeue(T& item);
+
+	// blocking attempts without the wakeup of the other side,
+	// wait_dequeue returns false once the queue is closed and empty
+	void wait_enqueue(const T& item);
+	bool wait_dequeue(T& item);
+
+	// bump the event word and wake up to n parked threads, only if there are
+	// any, so the enqueues and dequeues of a busy queue never write it
+	static void notify(std::atomic<int>* event, std::atomic<int>* waiters, int n);
+
+	// the maximum buffer size
+	int buffer_size;
+	// the slots of the ring
+	Slot* buffer;
+
+	char pad0[CACHE_LINE_SIZE];
+	// the position of the next dequeue
+	Counter head;
+	char pad1[CACHE_LINE_SIZE - sizeof(Counter)];
+	// the position of the next enqueue
+	Counter tail;
+	char pad2[CACHE_LINE_SIZE - sizeof(Counter)];
+
+	// the futex word bumped when a dequeue makes room for parked enqueuers,
+	// and the number of them, on their own line
+	std::atomic<int> not_full;
+	std::atomic<int> full_waiters;
+	char pad3[CACHE_LINE_SIZE - 2 * sizeof(std::atomic<int>)];
+	// the futex word bumped when an enqueue or close has work for parked
+	// dequeuers, and the number of them
+	std::atomic<int> not_empty;
+	std::atomic<int> empty_waiters;
+	char pad4[CACHE_LINE_SIZE - 2 * sizeof(std::atomic<int>)];
+
+	// whether no more elements will be enqueued
+	std::atomic<bool> closed;
+};
+
+// Implementation start
+
+template <class T>
+LFQueue<T>::LFQueue() : LFQueue(DEFAULT_BUFFER_SIZE) {
+}
+
+template <class T>
+LFQueue<T>::LFQueue(int buffer_size) : buffer_size(buffer_size < 2 ? 2 : buffer_size), head(0), tail(0),
+	not_full(0), full_waiters(0), not_empty(0), empty_waiters(0), closed(false) {
+	buffer = new Slot [this->buffer_size];
+	for (int i = 0; i < this->buffer_size; i++)
+		buffer[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template <class T>
+LFQueue<T>::~LFQueue() {
+	delete [] buffer;
+}
+
+template <class T>
+void LFQueue<T>::enqueue(T item) {
+	wait_enqueue(item);
+	notify(&not_empty, &empty_waiters, 1);
+}
+
+template <class T>
+T LFQueue<T>::dequeue() {
+	T element;
+	if (!wait_dequeue(element))
+		return T();
+	notify(&not_full, &full_waiters, 1);
+	return element;
+}
+
+template <class T>
+void LFQueue<T>::enqueue_bulk(T* items, int n) {
+	int pending = 0;
+	for (int i = 0; i < n; i++) {
+		if (try_enqueue(items[i])) {
+			pending++;
+			continue;
+		}
+		// wake the consumers of what is already in before parking
+		notify(&not_empty, &empty_waiters, pending);
+		pending = 1;
+		wait_enqueue(items[i]);
+	}
+	notify(&not_empty, &empty_waiters, pending);
+}
+
+template <class T>
+int LFQueue<T>::dequeue_bulk(T* items, int max) {
+	if (!wait_dequeue(items[0]))
+		return 0;
+	int moved = 1;
+	while (moved < max && try_dequeue(items[moved]))
+		moved++;
+	notify(&not_full, &full_waiters, moved);
+	return moved;
+}
+
+template <class T>
+int LFQueue<T>::try_dequeue_bulk(T* items, int max) {
+	int moved = 0;
+	while (moved < max && try_dequeue(items[moved]))
+		moved++;
+	notify(&not_full, &full_waiters, moved);
+	return moved;
+}
+
+template <class T>
+void LFQueue<T>::wait_enqueue(const T& item) {
+	while (!try_enqueue(item)) {
+		int seen = not_full.load();
+		full_waiters++;
+		bool done = try_enqueue(item);
+		if (!done)
+			futex_wait(&not_full, seen);
+		full_waiters--;
+		if (done)
+			break;
+	}
+}
+
+template <class T>
+bool LFQueue<T>::wait_dequeue(T& item) {
+	while (!try_dequeue(item)) {
+		// close comes after the last enqueue, so one more try sees everything
+		if (closed.load())
+			return try_dequeue(item);
+		int seen = not_empty.load();
+		empty_waiters++;
+		bool done = try_dequeue(item);
+		if (!done && !closed.load())
+			futex_wait(&not_empty, seen);
+		empty_waiters--;
+		if (done)
+			break;
+	}
+	return true;
+}
+
+template <class T>
+int LFQueue<T>::get_size() {
+	long long size = (long long)(tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed));
+	if (size < 0)
+		return 0;
+	return size > buffer_size ? buffer_size : (int)size;
+}
+
+template <class T>
+int LFQueue<T>::get_capacity() {
+	return buffer_size;
+}
+
+template <class T>
+bool LFQueue<T>::try_enqueue(const T& item) {
+	unsigned long long pos = tail.load(std::memory_order_relaxed);
+	while (true) {
+		Slot& slot = buffer[pos % buffer_size];
+		long long diff = (long long)(slot.seq.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				slot.value = item;
+				slot.seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T>
+bool LFQueue<T>::try_dequeue(T& item) {
+	unsigned long long pos = head.load(std::memory_order_relaxed);
+	while (true) {
+		Slot& slot = buffer[pos % buffer_size];
+		long long diff = (long long)(slot.seq.load(std::memory_order_acquire) - (pos + 1));
+		if (diff == 0) {
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				item = slot.value;
+				slot.seq.store(pos + buffer_size, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T>
+void LFQueue<T>::close() {
+	closed.store(true);
+	not_empty++;
+	futex_wake(&not_empty, INT_MAX);
+}
+
+template <class T>
+bool LFQueue<T>::is_closed() {
+	return closed.load();
+}
+
+template <class T>
+void LFQueue<T>::notify(std::atomic<int>* event, std::atomic<int>* waiters, int n) {
+	if (n == 0)
+		return;
+	// orders the elements published before against the load of waiters,
+	// pairing with the increment a waiter does before its last try
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters->load(std::memory_order_relaxed) > 0) {
+		(*event)++;
+		futex_wake(event, n);
+	}
+}
+
+#endif // LF_QUEUE_HPP
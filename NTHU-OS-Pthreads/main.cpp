@@ -1,76 +1,381 @@
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include "ts_queue.hpp"
+#include <unistd.h>
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
 #include "reader.hpp"
+#include "mmap_reader.hpp"
 #include "writer.hpp"
+#include "reorder_buffer.hpp"
 #include "producer.hpp"
 #include "consumer_controller.hpp"
+#include "pipeline_controller.hpp"
+#include "executor.hpp"
+#include "stats.hpp"
+#include "transform_cache.hpp"
+#include "placement.hpp"
+#include "queue_sizer.hpp"
+#include "value_stages.hpp"
 
 #define READER_QUEUE_SIZE 200
 #define WORKER_QUEUE_SIZE 200
 #define WRITER_QUEUE_SIZE 4000
 #define CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE 20
 #define CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE 80
-#define CONSUMER_CONTROLLER_CHECK_PERIOD 1000000
+#define CONSUMER_CONTROLLER_CHECK_PERIOD 100000
+#define CONSUMER_CONTROLLER_COOLDOWN_PERIOD 300000
+#define CONSUMER_CONTROLLER_MIN_CONSUMERS 1
+#define CONSUMER_CONTROLLER_MAX_CONSUMERS 16
+// the number of items each stage moves per queue operation,
+// workers transform items sharing an opcode side by side in SIMD lanes
+#define READER_BATCH_SIZE 16
+#define WORKER_BATCH_SIZE 8
+#define WRITER_BATCH_SIZE 64
+// 0 reads the input with one ifstream Reader, N > 0 mmaps it and parses it
+// in N newline-aligned chunks with N MmapReaders. The MmapReaders read the
+// whole file, so the line count argument may be left out and is ignored
+#ifndef MMAP_READERS
+#define MMAP_READERS 0
+#endif
+// N > 1 writes the output through N sharded Writers, each to its own file,
+// and merges the shards at the end
+#ifndef WRITER_SHARDS
+#define WRITER_SHARDS 1
+#endif
+// the number of buffered output bytes that triggers a write
+#define WRITER_FLUSH_THRESHOLD (1 << 16)
+// N > 0 writes the output in input order through a reorder buffer holding
+// up to N items, 0 writes it in completion order. N must exceed the high
+// threshold of the consumer controller, which only scales up past it
+#ifndef REORDER_WINDOW
+#define REORDER_WINDOW 0
+#endif
+// how the transforms run between the input and the writer queue
+#define PIPELINE_MODE_SPLIT 0
+#define PIPELINE_MODE_WORK_STEALING 1
+#define PIPELINE_MODE_FUSED 2
+#define PIPELINE_MODE_BY_VALUE 3
+// SPLIT runs 4 Producers and the scaled Consumers with the worker queue
+// between them, WORK_STEALING runs both on the workers of an Executor,
+// FUSED runs both in 4 Producers and only hands items to the Consumers while
+// the input queue is backed up past FUSED_SPLIT_THRESHOLD_PERCENTAGE.
+// BY_VALUE keeps the Items by value in TSQueue<Item> ring buffers, read,
+// transformed by EXECUTOR_WORKERS value workers and written without any item
+// allocation; the other options do not apply to it
+#ifndef PIPELINE_MODE
+#define PIPELINE_MODE PIPELINE_MODE_SPLIT
+#endif
+#define FUSED_SPLIT_THRESHOLD_PERCENTAGE 50
+// the number of Producers and Consumers that may run at once in SPLIT mode,
+// 0 keeps 4 Producers and scales only the Consumers, N scales both stages
+// from the depth of their input queue and moves threads to the bottleneck,
+// -1 takes the number of online cpus as the budget
+#ifndef THREAD_BUDGET
+#define THREAD_BUDGET 0
+#endif
+#define PIPELINE_CONTROLLER_INITIAL_PRODUCERS 4
+// the number of Executor workers, 0 for one per online CPU
+#ifndef EXECUTOR_WORKERS
+#define EXECUTOR_WORKERS 0
+#endif
+// how the pipeline threads are pinned to cpus, one of the PLACEMENT_ policies,
+// PLACEMENT_LIST takes the cpus of PLACEMENT_CPUS, e.g. -DPLACEMENT_CPUS=\"0,2,4-7\"
+#ifndef PLACEMENT_POLICY
+#define PLACEMENT_POLICY PLACEMENT_NONE
+#endif
+#ifndef PLACEMENT_CPUS
+#define PLACEMENT_CPUS ""
+#endif
+// 1 records per-stage wait and transform times, queue depths and controller
+// actions, and dumps them next to the output as .stats.csv and .events.csv
+#ifndef PIPELINE_STATS
+#define PIPELINE_STATS 0
+#endif
+// 1 resizes the reader and the writer queue online, up to QUEUE_AUTO_SIZE_FACTOR
+// times larger or smaller than their size, growing a queue whose enqueues
+// block QUEUE_AUTO_SIZE_GROW_BLOCKS times in a check period and shrinking a
+// mostly empty one. The worker queue keeps its size, its depth drives the
+// consumer controller. Ignored with TS_QUEUE_LOCK_FREE, whose ring is fixed
+#ifndef QUEUE_AUTO_SIZE
+#define QUEUE_AUTO_SIZE 0
+#endif
+#define QUEUE_AUTO_SIZE_FACTOR 4
+#define QUEUE_AUTO_SIZE_CHECK_PERIOD 10000
+#define QUEUE_AUTO_SIZE_GROW_BLOCKS 8
+// the number of transform results the Producers and Consumers memoize by
+// (stage, opcode, val) in TRANSFORM_CACHE_SHARDS shards, 0 for no cache.
+// The hits and misses of each stage are printed at exit
+#ifndef TRANSFORM_CACHE_SIZE
+#define TRANSFORM_CACHE_SIZE 0
+#endif
+#define TRANSFORM_CACHE_SHARDS 16
+// 1 applies the closed form of each transform instead of iterating
+#ifndef TRANSFORMER_FAST_MODE
+#define TRANSFORMER_FAST_MODE 0
+#endif
 
 int main(int argc, char** argv) {
-	assert(argc == 4);
+	// the mmap readers stop at the end of the file, and the writers at the
+	// end of their closed queue
+	bool mmap_input = MMAP_READERS > 0 && PIPELINE_MODE != PIPELINE_MODE_BY_VALUE;
+	assert(argc == 4 || (mmap_input && argc == 3));
 
-	int n = atoi(argv[1]);
-	std::string input_file_name(argv[2]);
-	std::string output_file_name(argv[3]);
+	int n = mmap_input ? Writer::UNTIL_CLOSED : atoi(argv[1]);
+	std::string input_file_name(argv[argc - 2]);
+	std::string output_file_name(argv[argc - 1]);
+
+	if (PIPELINE_MODE == PIPELINE_MODE_BY_VALUE) {
+		TSQueue<Item> input_queue(READER_QUEUE_SIZE);
+		TSQueue<Item> output_queue(WRITER_QUEUE_SIZE);
+		Transformer transformer(TRANSFORMER_FAST_MODE);
+		int workers = EXECUTOR_WORKERS > 0 ? EXECUTOR_WORKERS : sysconf(_SC_NPROCESSORS_ONLN);
+
+		ValueReader<TSQueue<Item>> reader(n, input_file_name, &input_queue, READER_BATCH_SIZE);
+		ValueWriter<TSQueue<Item>> writer(n, output_file_name, &output_queue, WRITER_BATCH_SIZE,
+			WRITER_FLUSH_THRESHOLD);
+		std::vector<ValueWorker<TSQueue<Item>>*> value_workers;
+		for (int i = 0; i < workers; i++)
+			value_workers.push_back(new ValueWorker<TSQueue<Item>>(&input_queue, &output_queue, &transformer,
+				WORKER_BATCH_SIZE));
+
+		reader.start();
+		writer.start();
+		for (ValueWorker<TSQueue<Item>>* worker : value_workers)
+			worker->start();
+
+		reader.join();
+		input_queue.close();
+		for (ValueWorker<TSQueue<Item>>* worker : value_workers) {
+			worker->join();
+			delete worker;
+		}
+		output_queue.close();
+		writer.join();
+		return 0;
+	}
 
 	// TODO: implements main function
-	TSQueue<Item*>* q1;
-	TSQueue<Item*>* q2;
-	TSQueue<Item*>* q3;
-
-	q1 = new TSQueue<Item*>(READER_QUEUE_SIZE); // Input Queue
-	q2 = new TSQueue<Item*>(WORKER_QUEUE_SIZE); // Worker Queue
-	q3 = new TSQueue<Item*>(WRITER_QUEUE_SIZE); // Writer Queue
-
-	Transformer* transformer = new Transformer;
-
-	Reader* reader = new Reader(n, input_file_name, q1);
-	Writer* writer = new Writer(n, output_file_name, q3);
-
-	Producer* p1 = new Producer(q1, q2, transformer);
-	Producer* p2 = new Producer(q1, q2, transformer);
-	Producer* p3 = new Producer(q1, q2, transformer);
-	Producer* p4 = new Producer(q1, q2, transformer);
-
-	ConsumerController * cc = new ConsumerController(
-	q2, 
-	q3, 
-	transformer, 
-	CONSUMER_CONTROLLER_CHECK_PERIOD, 
-	CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100, 
-	CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100);
+	ItemQueue* q1;
+	WorkerQueue* q2;
+	ItemQueue* q3;
+
+	q1 = new ItemQueue(READER_QUEUE_SIZE); // Input Queue
+	q2 = new WorkerQueue(WORKER_QUEUE_SIZE); // Worker Queue
+	q3 = new ItemQueue(WRITER_QUEUE_SIZE); // Writer Queue
+
+	// the Writer reads from the reorder buffer instead of the consumers
+	// when the output is ordered
+	ItemQueue* q4 = nullptr;
+	ReorderBuffer* reorder = nullptr;
+	if (REORDER_WINDOW > 0) {
+		q4 = new ItemQueue(WRITER_QUEUE_SIZE);
+		reorder = new ReorderBuffer(q3, q4, REORDER_WINDOW, WRITER_BATCH_SIZE);
+	}
+	ItemQueue* output_queue = reorder ? q4 : q3;
+
+	// items in flight are bounded by the total queue capacity,
+	// or by the reorder window before the reorder buffer
+	int growth = QUEUE_AUTO_SIZE ? QUEUE_AUTO_SIZE_FACTOR : 1;
+	ItemPool* pool = new ItemPool(READER_QUEUE_SIZE * growth + WORKER_QUEUE_SIZE + WRITER_QUEUE_SIZE * growth
+		+ REORDER_WINDOW);
+
+	QueueSizer* sizer = nullptr;
+#ifndef TS_QUEUE_LOCK_FREE
+	if (QUEUE_AUTO_SIZE) {
+		sizer = new QueueSizer(QUEUE_AUTO_SIZE_CHECK_PERIOD, QUEUE_AUTO_SIZE_GROW_BLOCKS);
+		sizer->watch(q1, "input_queue", READER_QUEUE_SIZE / QUEUE_AUTO_SIZE_FACTOR,
+			READER_QUEUE_SIZE * QUEUE_AUTO_SIZE_FACTOR);
+		sizer->watch(q3, "writer_queue", WRITER_QUEUE_SIZE / QUEUE_AUTO_SIZE_FACTOR,
+			WRITER_QUEUE_SIZE * QUEUE_AUTO_SIZE_FACTOR);
+	}
+#endif
+
+	if (PIPELINE_STATS)
+		Stats::enable();
+	if (TRANSFORM_CACHE_SIZE > 0)
+		TransformCache::enable(TRANSFORM_CACHE_SIZE, TRANSFORM_CACHE_SHARDS);
+
+	Transformer* transformer = new Transformer(TRANSFORMER_FAST_MODE);
+
+	std::vector<Thread*> readers;
+	MappedFile* input = nullptr;
+	if (mmap_input) {
+		input = new MappedFile(input_file_name);
+		for (int i = 0; i < MMAP_READERS; i++)
+			readers.push_back(new MmapReader(input, i, MMAP_READERS, q1, READER_BATCH_SIZE, pool, reorder));
+	} else {
+		readers.push_back(new Reader(n, input_file_name, q1, READER_BATCH_SIZE, pool, reorder));
+	}
+	std::vector<Writer*> writers;
+	std::vector<std::string> shard_file_names;
+	std::atomic<int> lines_to_write(n);
+	if (WRITER_SHARDS > 1) {
+		for (int i = 0; i < WRITER_SHARDS; i++) {
+			shard_file_names.push_back(output_file_name + "." + std::to_string(i));
+			writers.push_back(new Writer(&lines_to_write, shard_file_names.back(), output_queue, WRITER_BATCH_SIZE,
+				pool, WRITER_FLUSH_THRESHOLD));
+		}
+	} else {
+		writers.push_back(new Writer(n, output_file_name, output_queue, WRITER_BATCH_SIZE, pool,
+			WRITER_FLUSH_THRESHOLD));
+	}
+
+	std::vector<Producer*> producers;
+	ConsumerController* cc = nullptr;
+	PipelineController* pc = nullptr;
+	Executor* executor = nullptr;
+	int executor_workers = EXECUTOR_WORKERS > 0 ? EXECUTOR_WORKERS : sysconf(_SC_NPROCESSORS_ONLN);
+	if (PIPELINE_MODE == PIPELINE_MODE_WORK_STEALING) {
+		executor = new Executor(q1, q3, transformer, executor_workers, WORKER_BATCH_SIZE);
+	} else if (PIPELINE_MODE == PIPELINE_MODE_SPLIT && THREAD_BUDGET != 0) {
+		pc = new PipelineController(
+		q1,
+		q2,
+		q3,
+		transformer,
+		CONSUMER_CONTROLLER_CHECK_PERIOD,
+		THREAD_BUDGET > 0 ? THREAD_BUDGET : sysconf(_SC_NPROCESSORS_ONLN),
+		PIPELINE_CONTROLLER_INITIAL_PRODUCERS,
+		CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * READER_QUEUE_SIZE / 100,
+		CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * READER_QUEUE_SIZE / 100,
+		CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100,
+		CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100,
+		WORKER_BATCH_SIZE,
+		CONSUMER_CONTROLLER_COOLDOWN_PERIOD);
+	} else {
+		for (int i = 0; i < 4; i++) {
+			if (PIPELINE_MODE == PIPELINE_MODE_FUSED)
+				producers.push_back(new Producer(q1, q2, q3, transformer,
+					FUSED_SPLIT_THRESHOLD_PERCENTAGE * READER_QUEUE_SIZE / 100, WORKER_BATCH_SIZE));
+			else
+				producers.push_back(new Producer(q1, q2, transformer, WORKER_BATCH_SIZE));
+		}
+
+		cc = new ConsumerController(
+		q2, 
+		q3, 
+		transformer, 
+		CONSUMER_CONTROLLER_CHECK_PERIOD, 
+		CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100, 
+		CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100,
+		WORKER_BATCH_SIZE,
+		CONSUMER_CONTROLLER_MIN_CONSUMERS,
+		CONSUMER_CONTROLLER_MAX_CONSUMERS,
+		CONSUMER_CONTROLLER_COOLDOWN_PERIOD);
+	}
 	
-	reader->start();
-	writer->start();
-	cc->start();
-
-	p1->start();
-	p2->start();
-	p3->start();
-	p4->start();
+	// the threads get cpus in pipeline order, so with PLACEMENT_COMPACT each
+	// stage is next to the stages it shares a queue with, and the consumers
+	// run on the last-level cache of a producer
+	Placement placement(PLACEMENT_POLICY, Placement::parse_list(PLACEMENT_CPUS));
+	for (Thread* reader : readers)
+		reader->set_affinity(placement.next());
+	std::vector<std::vector<int>> worker_cpus;
+	if (executor) {
+		for (int i = 0; i < executor_workers; i++)
+			worker_cpus.push_back(placement.next());
+		executor->set_affinity(worker_cpus);
+	}
+	for (Producer* producer : producers) {
+		std::vector<int> cpus = placement.next();
+		producer->set_affinity(cpus);
+		if (!cpus.empty())
+			worker_cpus.push_back(placement.llc_of(cpus[0]));
+	}
+	if (cc)
+		cc->set_consumer_affinity(worker_cpus);
+	if (pc) {
+		// the stages share the cpus, one per thread of the budget
+		int budget = THREAD_BUDGET > 0 ? THREAD_BUDGET : sysconf(_SC_NPROCESSORS_ONLN);
+		for (int i = 0; i < budget; i++) {
+			std::vector<int> cpus = placement.next();
+			if (!cpus.empty())
+				worker_cpus.push_back(cpus);
+		}
+		pc->set_producer_affinity(worker_cpus);
+		pc->set_consumer_affinity(worker_cpus);
+	}
+	if (reorder)
+		reorder->set_affinity(placement.next());
+	for (Writer* writer : writers)
+		writer->set_affinity(placement.next());
+
+	for (Thread* reader : readers)
+		reader->start();
+	for (Writer* writer : writers)
+		writer->start();
+	if (reorder)
+		reorder->start();
+	if (executor)
+		executor->start();
+	if (cc)
+		cc->start();
+	if (pc)
+		pc->start();
+	if (sizer)
+		sizer->start();
+
+	for (Producer* producer : producers)
+		producer->start();
 	
-	reader->join();
-	writer->join();
+	// close every queue once the stages feeding it are done,
+	// so each stage drains its input and leaves
+	for (Thread* reader : readers)
+		reader->join();
+	q1->close();
+	for (Producer* producer : producers)
+		producer->join();
+	if (executor)
+		executor->join();
+	// the pipeline controller closes the worker queue after its producers
+	if (pc)
+		pc->join();
+	q2->close();
+	if (cc)
+		cc->join();
+	q3->close();
+	if (sizer)
+		sizer->join();
+	if (reorder) {
+		reorder->join();
+		q4->close();
+	}
+	for (Writer* writer : writers)
+		writer->join();
+	int status = 0;
+	if (WRITER_SHARDS > 1 && !Writer::merge(shard_file_names, output_file_name)) {
+		fprintf(stderr, "cannot merge the output shards into %s, they are kept\n", output_file_name.c_str());
+		status = 1;
+	}
+	Stats::dump(output_file_name + ".stats.csv", output_file_name + ".events.csv");
+	if (TransformCache* cache = TransformCache::instance()) {
+		printf("Transform cache: producer %lld hits %lld misses, consumer %lld hits %lld misses, %lld evictions\n",
+			cache->get_hits(TransformCache::PRODUCER), cache->get_misses(TransformCache::PRODUCER),
+			cache->get_hits(TransformCache::CONSUMER), cache->get_misses(TransformCache::CONSUMER),
+			cache->get_evictions());
+	}
 
-	delete p1;
-	delete p2;
-	delete p3;
-	delete p4;
+	for (Producer* producer : producers)
+		delete producer;
 	delete cc;
-	delete writer;
-	delete reader;
+	delete pc;
+	delete executor;
+	delete sizer;
+	delete reorder;
+	for (Writer* writer : writers)
+		delete writer;
+	for (Thread* reader : readers)
+		delete reader;
+	delete input;
 	delete transformer;
 	delete q1;
 	delete q2;
 	delete q3;
+	delete q4;
+	delete pool;
 
-	return 0;
+	return status;
 }
\ No newline at end of file
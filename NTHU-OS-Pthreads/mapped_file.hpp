@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+public:
+	// constructor
+	explicit MappedFile(std::string path);
+
+	// destructor
+	~MappedFile();
+
+	// the first byte of the file
+	const char* get_data();
+
+	// the size of the file in bytes
+	size_t get_size();
+
+	// the byte range of the i-th of n chunks of about the same size,
+	// chunk boundaries are moved to the start of a line
+	void get_chunk(int i, int n, const char** begin, const char** end);
+
+	// the number of lines before the i-th of n chunks, given the lines of
+	// that chunk. Every chunk's reader calls it once, publishing its own
+	// count and waiting for the counts of the earlier chunks, so the file is
+	// counted once, in parallel
+	long long lines_before(int i, int n, long long lines);
+private:
+	// the first line start at or after offset
+	size_t align(size_t offset);
+
+	const char* data;
+	size_t size;
+
+	// the published line counts of the chunks, -1 until published
+	std::vector<long long> chunk_lines;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_published;
+};
+
+// Implementation start
+
+MappedFile::MappedFile(std::string path) : data(nullptr), size(0) {
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond_published, nullptr);
+	int fd = open(path.c_str(), O_RDONLY);
+	assert(fd >= 0);
+
+	struct stat st;
+	fstat(fd, &st);
+	size = st.st_size;
+
+	if (size > 0) {
+		void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		assert(addr != MAP_FAILED);
+		madvise(addr, size, MADV_SEQUENTIAL);
+		data = (const char*)addr;
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (data)
+		munmap((void*)data, size);
+	pthread_cond_destroy(&cond_published);
+	pthread_mutex_destroy(&mutex);
+}
+
+const char* MappedFile::get_data() {
+	return data;
+}
+
+size_t MappedFile::get_size() {
+	return size;
+}
+
+void MappedFile::get_chunk(int i, int n, const char** begin, const char** end) {
+	*begin = data + align(size / n * i);
+	*end = data + (i == n - 1 ? size : align(size / n * (i + 1)));
+}
+
+long long MappedFile::lines_before(int i, int n, long long lines) {
+	pthread_mutex_lock(&mutex);
+	if ((int)chunk_lines.size() != n)
+		chunk_lines.assign(n, -1);
+	chunk_lines[i] = lines;
+	pthread_cond_broadcast(&cond_published);
+
+	long long before = 0;
+	for (int c = 0; c < i; c++) {
+		while (chunk_lines[c] < 0)
+			pthread_cond_wait(&cond_published, &mutex);
+		before += chunk_lines[c];
+	}
+	pthread_mutex_unlock(&mutex);
+	return before;
+}
+
+size_t MappedFile::align(size_t offset) {
+	while (offset > 0 && offset < size && data[offset - 1] != '\n')
+		offset++;
+	return offset;
+}
+
+#endif // MAPPED_FILE_HPP
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <vector>
+#include "thread.hpp"
+#include "item_queue.hpp"
+#include "item.hpp"
+#include "item_pool.hpp"
+#include "mapped_file.hpp"
+#include "reorder_buffer.hpp"
+#include "stats.hpp"
+
+#ifndef MMAP_READER_HPP
+#define MMAP_READER_HPP
+
+// A Reader parsing a memory-mapped input without iostreams.
+// It reads until the end of its chunk instead of an expected number of lines,
+// several MmapReaders can split one file into newline-aligned chunks.
+class MmapReader : public Thread {
+public:
+	// constructor, reads the chunk-th of chunks chunks of input
+	MmapReader(MappedFile* input, int chunk, int chunks, ItemQueue* input_queue, int batch_size = 1,
+		ItemPool* pool = nullptr, ReorderBuffer* reorder = nullptr);
+
+	// destructor
+	~MmapReader();
+
+	virtual void start() override;
+
+	// the number of items read so far
+	int get_lines_read();
+private:
+	// parses the next "key val opcode" line at or after p into item and
+	// moves p past it, returns false when there is no line left before end.
+	// Lines that do not parse are skipped, with a warning unless quiet
+	static bool parse(const char*& p, const char* end, Item* item, bool quiet);
+
+	// the number of lines of the chunk that parse
+	long long count_items();
+
+	// enqueues the first filled items of batch and empties it
+	void hand_over(Item** batch, int& filled);
+
+	MappedFile* input;
+	int chunk;
+	int chunks;
+
+	// the unread part of the chunk
+	const char* pos;
+	const char* end;
+
+	int lines_read;
+
+	ItemQueue* input_queue;
+
+	// the number of items handed to the input queue at once
+	int batch_size;
+
+	// where items come from, items are allocated with new when there is no pool
+	ItemPool* pool;
+
+	// the reorder buffer admitting every item for ordered output, if any
+	ReorderBuffer* reorder;
+
+	// the recorder of the reader thread, nullptr when stats are off
+	Stats::Recorder* stats;
+
+	// the method for pthread to create a reader thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+MmapReader::MmapReader(MappedFile* input, int chunk, int chunks, ItemQueue* input_queue, int batch_size,
+	ItemPool* pool, ReorderBuffer* reorder)
+	: input(input), chunk(chunk), chunks(chunks), lines_read(0), input_queue(input_queue), batch_size(batch_size), pool(pool),
+	  reorder(reorder), stats(nullptr) {
+	input->get_chunk(chunk, chunks, &pos, &end);
+}
+
+MmapReader::~MmapReader() {}
+
+void MmapReader::start() {
+	create(MmapReader::process, (void*)this);
+}
+
+int MmapReader::get_lines_read() {
+	return lines_read;
+}
+
+bool MmapReader::parse(const char*& p, const char* end, Item* item, bool quiet) {
+	while (true) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+			p++;
+		if (p == end)
+			return false;
+		const char* line = p;
+
+		bool negative = *p == '-';
+		p += negative;
+		unsigned int digit;
+		int key = 0;
+		const char* digits = p;
+		while (p < end && (digit = *p - '0') < 10) {
+			key = key * 10 + digit;
+			p++;
+		}
+		bool ok = p > digits;
+		item->key = negative ? -key : key;
+
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		unsigned long long val = 0;
+		digits = p;
+		while (p < end && (digit = *p - '0') < 10) {
+			val = val * 10 + digit;
+			p++;
+		}
+		ok = ok && p > digits;
+		item->val = val;
+
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		item->opcode = p < end ? *p : '\0';
+		ok = ok && ((item->opcode >= 'A' && item->opcode <= 'Z') || (item->opcode >= 'a' && item->opcode <= 'z'));
+
+		while (p < end && *p != '\n')
+			p++;
+		if (ok)
+			return true;
+		if (!quiet)
+			fprintf(stderr, "skipping a malformed input line: %.*s\n", (int)(p - line), line);
+	}
+}
+
+long long MmapReader::count_items() {
+	const char* p = pos;
+	Item item;
+	long long count = 0;
+	while (parse(p, end, &item, true))
+		count++;
+	return count;
+}
+
+void* MmapReader::process(void* arg) {
+	MmapReader* reader = (MmapReader*)arg;
+
+	std::vector<Item*> batch(reader->batch_size);
+	ItemPool::Cache* cache = reader->pool ? new ItemPool::Cache(reader->pool) : nullptr;
+	int filled = 0;
+	reader->stats = Stats::recorder("mmap_reader");
+	// the items of the earlier chunks come first, only the reorder buffer
+	// needs the global order, without it seq counts within the chunk. The
+	// malformed lines are not counted, so the reorder buffer sees no gap
+	long long seq = 0;
+	if (reader->reorder)
+		seq = reader->input->lines_before(reader->chunk, reader->chunks, reader->count_items());
+
+	Item* item = nullptr;
+	while (true) {
+		// hand over the partial batch before waiting for the window to move
+		// or for the Writer to return items
+		if (reader->reorder && !reader->reorder->try_admit(seq)) {
+			reader->hand_over(batch.data(), filled);
+			reader->reorder->admit(seq);
+		}
+		item = cache ? cache->try_acquire() : new Item;
+		if (!item) {
+			reader->hand_over(batch.data(), filled);
+			item = cache->acquire();
+		}
+
+		if (!parse(reader->pos, reader->end, item, false))
+			break;
+		item->seq = seq++;
+		batch[filled++] = item;
+		reader->lines_read++;
+		if (filled == reader->batch_size)
+			reader->hand_over(batch.data(), filled);
+	}
+	reader->hand_over(batch.data(), filled);
+
+	// the item acquired for the missing line goes back unused
+	if (cache)
+		cache->release(item);
+	else
+		delete item;
+	delete cache;
+
+	return nullptr;
+}
+
+void MmapReader::hand_over(Item** batch, int& filled) {
+	if (filled == 0)
+		return;
+	long long begin = stats ? Stats::now() : 0;
+	input_queue->enqueue_bulk(batch, filled);
+	if (stats) {
+		long long end = Stats::now();
+		stats->enqueue_wait.record(end - begin);
+		stats->handled(filled, end);
+	}
+	filled = 0;
+}
+
+#endif // MMAP_READER_HPP
@@ -10,6 +10,14 @@ echo ===============================================
 ./main 4000 ./tests/01.in ./tests/01.out
 echo ===============================================
 
+# b far above a small m, the SIMD batch kernels reduce it first
+./scripts/auto_gen_transformer --input ./tests/03_spec.json
+scl enable devtoolset-8 'make clean && make'
+echo ===============================================
+./main 200 ./tests/00.in ./tests/03.out
+echo ===============================================
+
 # Verify
 ./scripts/verify --output ./tests/00.out --answer ./tests/00.ans
-./scripts/verify --output ./tests/01.out --answer ./tests/01.ans
\ No newline at end of file
+./scripts/verify --output ./tests/01.out --answer ./tests/01.ans
+./scripts/verify --output ./tests/03.out --answer ./tests/03.ans
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include "item.hpp"
+#include "ts_queue.hpp"
+#include "cost_model.hpp"
+
+#ifndef OPCODE_QUEUE_HPP
+#define OPCODE_QUEUE_HPP
+
+// The worker queue split into one FIFO per opcode class, with the interface
+// of TSQueue<Item*>. A dequeue serves the class with the largest
+// (aging * wait + 1) / cost, where wait is how long the head of the class has
+// been queued and cost is the time per item the consumers measured for it,
+// both in ns. Cheap opcodes overtake a backlog of expensive ones, but the
+// priority of a waiting item grows with its wait so nothing starves. aging 0
+// is plain shortest-expected-job-first. Classes not measured yet are served
+// first so their cost gets learned.
+class OpcodeQueue {
+public:
+	// constructor
+	OpcodeQueue();
+
+	explicit OpcodeQueue(int max_buffer_size, double aging = 1.0);
+
+	// destructor
+	~OpcodeQueue();
+
+	// add an item to the end of the queue of its class
+	void enqueue(Item* item);
+
+	// remove and return the item chosen by the policy,
+	// or nullptr once the queue is closed and empty
+	Item* dequeue();
+
+	// add n items to the queues of their classes
+	void enqueue_bulk(Item** items, int n);
+
+	// remove up to max items into items, taken class by class in policy
+	// order, blocks until at least one is available and returns the number
+	// removed, 0 once the queue is closed and empty
+	int dequeue_bulk(Item** items, int max);
+
+	// the same as dequeue_bulk without blocking, returns 0 when empty
+	int try_dequeue_bulk(Item** items, int max);
+
+	// return the number of items in all classes
+	int get_size();
+
+	// mark the end of the input, after the last enqueue
+	void close();
+
+	// return whether close was called
+	bool is_closed();
+
+	// the costs the consumers feed and the policy reads
+	CostModel* get_costs();
+private:
+	// the class to dequeue from next, -1 when all are empty
+	int pick(long long now);
+
+	// move up to max items of the best classes into items, under the lock
+	int take(Item** items, int max);
+
+	static long long now();
+
+	// the maximum number of items in all classes together
+	int buffer_size;
+	double aging;
+
+	// a ring per class with the enqueue time of every item
+	Item** buffer[COST_MODEL_CLASSES];
+	long long* enqueued[COST_MODEL_CLASSES];
+	int head[COST_MODEL_CLASSES];
+	int count[COST_MODEL_CLASSES];
+	// the number of items in all classes, and its copy for readers without
+	// the lock
+	int size;
+	std::atomic<int> published_size;
+	bool closed;
+
+	CostModel costs;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_enqueue, cond_dequeue;
+};
+
+// Implementation start
+
+OpcodeQueue::OpcodeQueue() : OpcodeQueue(DEFAULT_BUFFER_SIZE) {
+}
+
+OpcodeQueue::OpcodeQueue(int buffer_size, double aging)
+	: buffer_size(buffer_size), aging(aging), size(0), published_size(0), closed(false) {
+	for (int c = 0; c < COST_MODEL_CLASSES; c++) {
+		buffer[c] = new Item* [buffer_size];
+		enqueued[c] = new long long [buffer_size];
+		head[c] = 0;
+		count[c] = 0;
+	}
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_enqueue, NULL);
+	pthread_cond_init(&cond_dequeue, NULL);
+}
+
+OpcodeQueue::~OpcodeQueue() {
+	for (int c = 0; c < COST_MODEL_CLASSES; c++) {
+		delete [] buffer[c];
+		delete [] enqueued[c];
+	}
+	pthread_cond_destroy(&cond_enqueue);
+	pthread_cond_destroy(&cond_dequeue);
+	pthread_mutex_destroy(&mutex);
+}
+
+void OpcodeQueue::enqueue(Item* item) {
+	enqueue_bulk(&item, 1);
+}
+
+Item* OpcodeQueue::dequeue() {
+	Item* item;
+	return dequeue_bulk(&item, 1) ? item : nullptr;
+}
+
+void OpcodeQueue::enqueue_bulk(Item** items, int n) {
+	long long time = now();
+	pthread_mutex_lock(&mutex);
+	while (n > 0) {
+		while (size == buffer_size)
+			pthread_cond_wait(&cond_enqueue, &mutex);
+		int moved = 0;
+		while (moved < n && size < buffer_size) {
+			int c = CostModel::class_of(items[moved]->opcode);
+			int tail = (head[c] + count[c]) % buffer_size;
+			buffer[c][tail] = items[moved++];
+			enqueued[c][tail] = time;
+			count[c]++;
+			size++;
+		}
+		published_size.store(size, std::memory_order_relaxed);
+		items += moved;
+		n -= moved;
+		if (moved == 1)
+			pthread_cond_signal(&cond_dequeue);
+		else
+			pthread_cond_broadcast(&cond_dequeue);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+int OpcodeQueue::dequeue_bulk(Item** items, int max) {
+	pthread_mutex_lock(&mutex);
+	while (size == 0 && !closed)
+		pthread_cond_wait(&cond_dequeue, &mutex);
+	int moved = take(items, max);
+	pthread_mutex_unlock(&mutex);
+	return moved;
+}
+
+int OpcodeQueue::try_dequeue_bulk(Item** items, int max) {
+	pthread_mutex_lock(&mutex);
+	int moved = take(items, max);
+	pthread_mutex_unlock(&mutex);
+	return moved;
+}
+
+int OpcodeQueue::get_size() {
+	return published_size.load(std::memory_order_relaxed);
+}
+
+void OpcodeQueue::close() {
+	pthread_mutex_lock(&mutex);
+	closed = true;
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&mutex);
+}
+
+bool OpcodeQueue::is_closed() {
+	pthread_mutex_lock(&mutex);
+	bool ret = closed;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+CostModel* OpcodeQueue::get_costs() {
+	return &costs;
+}
+
+int OpcodeQueue::pick(long long now) {
+	int best = -1;
+	double best_priority = 0;
+	for (int c = 0; c < COST_MODEL_CLASSES; c++) {
+		if (count[c] == 0)
+			continue;
+		long long cost = costs.get_cost(c);
+		if (cost == 0)
+			return c;
+		double priority = (aging * (now - enqueued[c][head[c]]) + 1) / cost;
+		if (priority > best_priority) {
+			best = c;
+			best_priority = priority;
+		}
+	}
+	return best;
+}
+
+int OpcodeQueue::take(Item** items, int max) {
+	if (size == 0)
+		return 0;
+	long long time = now();
+	int moved = 0;
+	// drain the best class before looking at the next, the items of a
+	// batch then mostly share an opcode and are transformed together
+	int c;
+	while (moved < max && (c = pick(time)) >= 0) {
+		while (moved < max && count[c] > 0) {
+			items[moved++] = buffer[c][head[c]];
+			head[c] = (head[c] + 1) % buffer_size;
+			count[c]--;
+			size--;
+		}
+	}
+	published_size.store(size, std::memory_order_relaxed);
+	if (moved == 1)
+		pthread_cond_signal(&cond_enqueue);
+	else if (moved > 1)
+		pthread_cond_broadcast(&cond_enqueue);
+	return moved;
+}
+
+long long OpcodeQueue::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif // OPCODE_QUEUE_HPP
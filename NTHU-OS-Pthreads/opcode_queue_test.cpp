@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include "opcode_queue.hpp"
+
+// Queues a backlog of expensive 'B' items behind which cheap 'C' items
+// arrive, prints the dequeue order without and with aging.
+void run(double aging) {
+	OpcodeQueue* q = new OpcodeQueue(20, aging);
+	q->get_costs()->record('B', 12000);
+	q->get_costs()->record('C', 1000);
+
+	Item* items[10];
+	for (int i = 0; i < 5; i++)
+		items[i] = new Item(i, 0, 'B');
+	q->enqueue_bulk(items, 5);
+	// the backlog has waited long enough to beat any fresh cheap item
+	usleep(100000);
+	for (int i = 5; i < 10; i++)
+		items[i] = new Item(i, 0, 'C');
+	q->enqueue_bulk(items + 5, 5);
+	q->close();
+
+	printf("aging %.0f:", aging);
+	Item* item;
+	while ((item = q->dequeue()) != nullptr) {
+		printf(" %d%c", item->key, item->opcode);
+		delete item;
+	}
+	printf("\n");
+	delete q;
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 1);
+
+	// shortest first: 5C 6C 7C 8C 9C 0B 1B 2B 3B 4B
+	run(0);
+	// aged: 0B 1B 2B 3B 4B 5C 6C 7C 8C 9C
+	run(1);
+
+	return 0;
+}
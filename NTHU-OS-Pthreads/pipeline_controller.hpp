@@ -0,0 +1,266 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "thread.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
+#include "transformer.hpp"
+#include "producer.hpp"
+#include "consumer.hpp"
+#include "scaling_policy.hpp"
+#include "stats.hpp"
+
+#ifndef PIPELINE_CONTROLLER_HPP
+#define PIPELINE_CONTROLLER_HPP
+
+// Scales the Producers and the Consumers together under a budget of threads.
+// Each stage has a ScalingPolicy on the depth of its own input queue, the
+// input queue for the producers and the worker queue for the consumers.
+// When the two want more threads than the budget, the stage whose input queue
+// is fuller relative to its high threshold is the bottleneck: it grows first
+// and the other one gives threads up, down to one.
+// The controller keeps scaling until the input queue is closed and drained,
+// then joins the producers, closes the worker queue and hands the whole
+// budget to the consumers to drain it, so joining it means both stages are
+// done. No more threads than the budget take items at any point.
+class PipelineController : public Thread {
+   public:
+    // constructor, the thresholds are in items of the queue each stage reads
+    PipelineController(
+        ItemQueue* input_queue,
+        WorkerQueue* worker_queue,
+        ItemQueue* writer_queue,
+        Transformer* transformer,
+        int check_period,
+        int thread_budget,
+        int initial_producers,
+        int producer_low_threshold,
+        int producer_high_threshold,
+        int consumer_low_threshold,
+        int consumer_high_threshold,
+        int batch_size = 1,
+        int cooldown_period = 0);
+
+    // destructor
+    ~PipelineController();
+
+    virtual void start() override;
+
+    // run producer i only on cpus[i % cpus.size()], set before start
+    void set_producer_affinity(std::vector<std::vector<int>> cpus);
+
+    // run consumer i only on cpus[i % cpus.size()], set before start
+    void set_consumer_affinity(std::vector<std::vector<int>> cpus);
+
+   private:
+    // the largest number of threads each stage may get, the rest of the
+    // budget after one thread of the other stage, all spawned up front with
+    // the first active of them taking items and the rest parked
+    int max_threads;
+    std::vector<Producer*> producers;
+    int active_producers;
+    std::vector<Consumer*> consumers;
+    int active_consumers;
+    std::vector<std::vector<int>> producer_cpus;
+    std::vector<std::vector<int>> consumer_cpus;
+
+    ItemQueue* input_queue;
+    WorkerQueue* worker_queue;
+    ItemQueue* writer_queue;
+
+    Transformer* transformer;
+
+    // Check to scale every check period in microseconds.
+    int check_period;
+    // The number of producers and consumers that may take items at once.
+    int thread_budget;
+    int initial_producers;
+    // The depth past which a stage is scaled up, to compare the stages.
+    int producer_high_threshold;
+    int consumer_high_threshold;
+    // The batch size given to every producer and consumer.
+    int batch_size;
+
+    ScalingPolicy producer_policy;
+    ScalingPolicy consumer_policy;
+
+    // cut the targets of the stages down to the budget, the stage under
+    // more pressure keeps its target first
+    void arbitrate(int& producers, int& consumers, double producer_pressure, double consumer_pressure);
+
+    // unpark or park threads of a stage until target of them are active
+    template <class Worker>
+    static void scale(std::vector<Worker*>& workers, int& active, int target, const char* name);
+
+    // the monotonic time in microseconds
+    static long long now();
+
+    static void* process(void* arg);
+};
+
+// Implementation start
+
+PipelineController::PipelineController(
+    ItemQueue* input_queue,
+    WorkerQueue* worker_queue,
+    ItemQueue* writer_queue,
+    Transformer* transformer,
+    int check_period,
+    int thread_budget,
+    int initial_producers,
+    int producer_low_threshold,
+    int producer_high_threshold,
+    int consumer_low_threshold,
+    int consumer_high_threshold,
+    int batch_size,
+    int cooldown_period) : max_threads(thread_budget > 2 ? thread_budget - 1 : 1),
+                           active_producers(0),
+                           active_consumers(0),
+                           input_queue(input_queue),
+                           worker_queue(worker_queue),
+                           writer_queue(writer_queue),
+                           transformer(transformer),
+                           check_period(check_period),
+                           thread_budget(thread_budget > 2 ? thread_budget : 2),
+                           initial_producers(initial_producers),
+                           producer_high_threshold(producer_high_threshold > 0 ? producer_high_threshold : 1),
+                           consumer_high_threshold(consumer_high_threshold > 0 ? consumer_high_threshold : 1),
+                           batch_size(batch_size),
+                           producer_policy(producer_low_threshold, producer_high_threshold, 1, max_threads,
+                               cooldown_period),
+                           consumer_policy(consumer_low_threshold, consumer_high_threshold, 1, max_threads,
+                               cooldown_period) {
+}
+
+PipelineController::~PipelineController() {}
+
+void PipelineController::start() {
+    create(PipelineController::process, (void*)this);
+}
+
+void PipelineController::set_producer_affinity(std::vector<std::vector<int>> cpus) {
+    producer_cpus = cpus;
+}
+
+void PipelineController::set_consumer_affinity(std::vector<std::vector<int>> cpus) {
+    consumer_cpus = cpus;
+}
+
+void PipelineController::arbitrate(int& producers, int& consumers, double producer_pressure,
+    double consumer_pressure) {
+    if (producers + consumers <= thread_budget)
+        return;
+    bool producers_first = producer_pressure >= consumer_pressure;
+    int& first = producers_first ? producers : consumers;
+    int& second = producers_first ? consumers : producers;
+    if (first > thread_budget - 1)
+        first = thread_budget - 1;
+    if (second > thread_budget - first)
+        second = thread_budget - first;
+}
+
+template <class Worker>
+void PipelineController::scale(std::vector<Worker*>& workers, int& active, int target, const char* name) {
+    int size = active;
+    if (target == size)
+        return;
+
+    while (active < target)
+        workers[active++]->unpark();
+    while (active > target)
+        workers[--active]->park();
+    printf("Scaling %s %s from %d to %d\n", target > size ? "up" : "down", name, size, target);
+    Stats::event(name, target);
+}
+
+long long PipelineController::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void* PipelineController::process(void* arg) {
+    PipelineController* pc = (PipelineController*)arg;
+
+    for (int i = 0; i < pc->max_threads; i++) {
+        Producer* producer = new Producer(pc->input_queue, pc->worker_queue, pc->transformer, pc->batch_size);
+        producer->park();
+        if (!pc->producer_cpus.empty())
+            producer->set_affinity(pc->producer_cpus[i % pc->producer_cpus.size()]);
+        producer->start();
+        pc->producers.push_back(producer);
+
+        Consumer* consumer = new Consumer(pc->worker_queue, pc->writer_queue, pc->transformer, pc->batch_size);
+        consumer->park();
+        if (!pc->consumer_cpus.empty())
+            consumer->set_affinity(pc->consumer_cpus[i % pc->consumer_cpus.size()]);
+        consumer->start();
+        pc->consumers.push_back(consumer);
+    }
+
+    int producers = pc->initial_producers;
+    int consumers = pc->consumer_policy.start(now());
+    pc->producer_policy.start(now());
+    if (producers < 1)
+        producers = 1;
+    if (producers > pc->max_threads)
+        producers = pc->max_threads;
+    pc->arbitrate(producers, consumers, 1, 0);
+    scale(pc->producers, pc->active_producers, producers, "producers");
+    scale(pc->consumers, pc->active_consumers, consumers, "consumers");
+
+    struct timespec period;
+    period.tv_sec = pc->check_period / 1000000;
+    period.tv_nsec = pc->check_period % 1000000 * 1000L;
+
+    while (!pc->input_queue->is_closed() || pc->input_queue->get_size() > 0) {
+        int input_depth = pc->input_queue->get_size();
+        int worker_depth = pc->worker_queue->get_size();
+        Stats::event("input_queue_depth", input_depth);
+        Stats::event("worker_queue_depth", worker_depth);
+
+        producers = pc->producer_policy.next(pc->active_producers, input_depth, now());
+        consumers = pc->consumer_policy.next(pc->active_consumers, worker_depth, now());
+        pc->arbitrate(producers, consumers, (double)input_depth / pc->producer_high_threshold,
+            (double)worker_depth / pc->consumer_high_threshold);
+        // shrink first so the budget holds while switching
+        if (producers < pc->active_producers)
+            scale(pc->producers, pc->active_producers, producers, "producers");
+        if (consumers < pc->active_consumers)
+            scale(pc->consumers, pc->active_consumers, consumers, "consumers");
+        scale(pc->producers, pc->active_producers, producers, "producers");
+        scale(pc->consumers, pc->active_consumers, consumers, "consumers");
+
+        nanosleep(&period, nullptr);
+    }
+
+    // the parked producers wake up to find the input queue closed and
+    // empty and leave without taking an item, the active ones finish their
+    // last batch
+    for (int i = pc->active_producers; i < (int)pc->producers.size(); i++)
+        pc->producers[i]->unpark();
+    for (Producer* producer : pc->producers) {
+        producer->join();
+        delete producer;
+    }
+    pc->producers.clear();
+    pc->worker_queue->close();
+
+    // the producers are gone, so the consumers may take every thread of the
+    // budget to drain the worker queue and leave
+    for (Consumer* consumer : pc->consumers)
+        consumer->unpark();
+    for (Consumer* consumer : pc->consumers) {
+        consumer->join();
+        delete consumer;
+    }
+    pc->consumers.clear();
+
+    return nullptr;
+}
+
+#endif  // PIPELINE_CONTROLLER_HPP
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+// how pipeline threads are placed on cpus
+#define PLACEMENT_NONE 0
+// fill the SMT siblings of a core, then the cores of a last-level cache
+#define PLACEMENT_COMPACT 1
+// one thread per last-level cache, then per core, then per SMT sibling
+#define PLACEMENT_SPREAD 2
+// the cpus given explicitly, in order
+#define PLACEMENT_LIST 3
+
+// Hands out cpus to the pipeline threads, in the order they are asked for,
+// following a policy over the cpu topology read from sysfs. Threads asked
+// for one after the other land on neighbouring cpus with COMPACT, so the
+// stages sharing a queue also share a last-level cache.
+class Placement {
+public:
+	// constructor, cpus is the list used by PLACEMENT_LIST
+	explicit Placement(int policy, std::vector<int> cpus = std::vector<int>());
+
+	// the cpus of the next thread, empty when threads are not pinned
+	std::vector<int> next();
+
+	// the online cpus sharing the last-level cache of cpu
+	std::vector<int> llc_of(int cpu);
+
+	// parses a sysfs cpu list such as "0-3,8,10-11"
+	static std::vector<int> parse_list(std::string list);
+private:
+	struct Cpu {
+		int id;
+		int core;
+		int llc;
+	};
+
+	// reads one line of a sysfs file, empty when it does not exist
+	static std::string read_line(std::string path);
+
+	// the first cpu of the highest cache level shared by cpu
+	static int read_llc(int cpu);
+
+	int policy;
+	std::vector<Cpu> topology;
+	// the cpus in the order threads get them
+	std::vector<int> order;
+	int handed;
+};
+
+// Implementation start
+
+Placement::Placement(int policy, std::vector<int> cpus) : policy(policy), handed(0) {
+	std::string online = read_line("/sys/devices/system/cpu/online");
+	for (int id : parse_list(online)) {
+		std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+		std::string package = read_line(base + "physical_package_id");
+		std::string core = read_line(base + "core_id");
+		Cpu cpu;
+		cpu.id = id;
+		// cores are only unique within a package
+		cpu.core = (package.empty() ? 0 : atoi(package.c_str())) * 65536 + (core.empty() ? id : atoi(core.c_str()));
+		cpu.llc = read_llc(id);
+		topology.push_back(cpu);
+	}
+
+	if (policy == PLACEMENT_LIST) {
+		order = cpus;
+	} else if (policy == PLACEMENT_COMPACT) {
+		std::vector<Cpu> sorted = topology;
+		std::sort(sorted.begin(), sorted.end(), [](const Cpu& a, const Cpu& b) {
+			if (a.llc != b.llc)
+				return a.llc < b.llc;
+			if (a.core != b.core)
+				return a.core < b.core;
+			return a.id < b.id;
+		});
+		for (const Cpu& cpu : sorted)
+			order.push_back(cpu.id);
+	} else if (policy == PLACEMENT_SPREAD) {
+		// rank every cpu among the siblings of its core and the cores of its llc
+		std::vector<int> sibling(topology.size()), core(topology.size());
+		for (int i = 0; i < (int)topology.size(); i++) {
+			std::vector<int> cores;
+			for (int j = 0; j < i; j++) {
+				if (topology[j].core == topology[i].core)
+					sibling[i]++;
+				else if (topology[j].llc == topology[i].llc
+					&& std::find(cores.begin(), cores.end(), topology[j].core) == cores.end())
+					cores.push_back(topology[j].core);
+			}
+			core[i] = cores.size();
+		}
+		std::vector<int> index(topology.size());
+		for (int i = 0; i < (int)index.size(); i++)
+			index[i] = i;
+		std::sort(index.begin(), index.end(), [&](int a, int b) {
+			if (sibling[a] != sibling[b])
+				return sibling[a] < sibling[b];
+			if (core[a] != core[b])
+				return core[a] < core[b];
+			return topology[a].llc < topology[b].llc;
+		});
+		for (int i : index)
+			order.push_back(topology[i].id);
+	}
+}
+
+std::vector<int> Placement::next() {
+	if (order.empty())
+		return std::vector<int>();
+	return std::vector<int>(1, order[handed++ % order.size()]);
+}
+
+std::vector<int> Placement::llc_of(int cpu) {
+	int llc = -1;
+	for (const Cpu& c : topology)
+		if (c.id == cpu)
+			llc = c.llc;
+	std::vector<int> cpus;
+	for (const Cpu& c : topology)
+		if (c.llc == llc)
+			cpus.push_back(c.id);
+	return cpus;
+}
+
+std::vector<int> Placement::parse_list(std::string list) {
+	std::vector<int> cpus;
+	const char* p = list.c_str();
+	while (*p) {
+		char* end;
+		int first = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		int last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+		if (*p == ',')
+			p++;
+	}
+	return cpus;
+}
+
+std::string Placement::read_line(std::string path) {
+	FILE* f = fopen(path.c_str(), "r");
+	if (!f)
+		return "";
+	char buf[256] = {0};
+	if (!fgets(buf, sizeof(buf), f))
+		buf[0] = '\0';
+	fclose(f);
+	std::string line(buf);
+	while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+		line.pop_back();
+	return line;
+}
+
+int Placement::read_llc(int cpu) {
+	std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+	int best_level = -1, llc = cpu;
+	for (int i = 0; ; i++) {
+		std::string level = read_line(base + std::to_string(i) + "/level");
+		if (level.empty())
+			break;
+		std::vector<int> shared = parse_list(read_line(base + std::to_string(i) + "/shared_cpu_list"));
+		if (atoi(level.c_str()) > best_level && !shared.empty()) {
+			best_level = atoi(level.c_str());
+			llc = shared[0];
+		}
+	}
+	return llc;
+}
+
+#endif // PLACEMENT_HPP
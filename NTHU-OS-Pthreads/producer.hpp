@@ -1,8 +1,15 @@
 #include <pthread.h>
+#include <atomic>
+#include <vector>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "batch_transform.hpp"
+#include "stats.hpp"
+#include "futex.hpp"
+#include "transform_cache.hpp"
 
 #ifndef PRODUCER_HPP
 #define PRODUCER_HPP
@@ -10,41 +17,116 @@
 class Producer : public Thread {
 public:
 	// constructor
-	Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transfomrer);
+	Producer(ItemQueue* input_queue, WorkerQueue* worker_queue, Transformer* transfomrer, int batch_size = 1);
+
+	// constructor of a fused producer, which also applies the consumer
+	// transform and hands items straight to output_queue, unless the input
+	// queue holds more than split_threshold items and the consumers have
+	// to share the work through the worker queue
+	Producer(ItemQueue* input_queue, WorkerQueue* worker_queue, ItemQueue* output_queue, Transformer* transfomrer,
+		int split_threshold, int batch_size = 1);
 
 	// destructor
 	~Producer();
 
 	virtual void start();
+
+	// stop taking items after the current batch and sleep until unpark
+	void park();
+
+	// resume taking items
+	void unpark();
 private:
-	TSQueue<Item*>* input_queue;
-	TSQueue<Item*>* worker_queue;
+	ItemQueue* input_queue;
+	WorkerQueue* worker_queue;
+	// where a fused producer puts the items it consumed itself, nullptr when not fused
+	ItemQueue* output_queue;
 
 	Transformer* transformer;
 
+	int split_threshold;
+
+	// the maximum number of items taken from the input queue at once
+	int batch_size;
+
+	// futex word, 1 while the producer takes items and 0 while it is parked
+	std::atomic<int> running;
+
 	// the method for pthread to create a producer thread
 	static void* process(void* arg);
 };
 
-Producer::Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transformer)
-	: input_queue(input_queue), worker_queue(worker_queue), transformer(transformer) {
+Producer::Producer(ItemQueue* input_queue, WorkerQueue* worker_queue, Transformer* transformer, int batch_size)
+	: input_queue(input_queue), worker_queue(worker_queue), output_queue(nullptr), transformer(transformer),
+	  split_threshold(0), batch_size(batch_size), running(1) {
+}
+
+Producer::Producer(ItemQueue* input_queue, WorkerQueue* worker_queue, ItemQueue* output_queue,
+	Transformer* transformer, int split_threshold, int batch_size)
+	: input_queue(input_queue), worker_queue(worker_queue), output_queue(output_queue), transformer(transformer),
+	  split_threshold(split_threshold), batch_size(batch_size), running(1) {
 }
 
 Producer::~Producer() {}
 
+void Producer::park() {
+	running.store(0);
+}
+
+void Producer::unpark() {
+	running.store(1);
+	futex_wake(&running, 1);
+}
+
 void Producer::start() {
 	// TODO: starts a Producer thread
-	pthread_create(&t, 0, Producer::process, (void *)this);
+	create(Producer::process, (void*)this);
 }
 
 void* Producer::process(void* arg) {
 	// TODO: implements the Producer's work
 	Producer* producer = (Producer *)arg;
 
+	std::vector<Item*> batch(producer->batch_size);
+	Stats::Recorder* stats = Stats::recorder(producer->output_queue ? "fused_producer" : "producer");
+	TransformCache* cache = TransformCache::instance();
+	long long begin = 0;
+
 	while(true) {
-		Item* item = producer->input_queue->dequeue();
-		item->val = producer->transformer->producer_transform(item->opcode, item->val);
-		producer->worker_queue->enqueue(item);
+		if (!producer->running.load()) {
+			futex_wait(&producer->running, 0);
+			continue;
+		}
+
+		if (stats)
+			begin = Stats::now();
+		int n = producer->input_queue->dequeue_bulk(batch.data(), producer->batch_size);
+		// the input queue is closed and drained
+		if (n == 0)
+			break;
+		if (stats)
+			stats->dequeue_wait.record(Stats::now() - begin);
+		transform_items(producer->transformer, &Transformer::producer_transform_batch, batch.data(), n, stats,
+			nullptr, cache);
+
+		// consume the batch while the values are still in cache,
+		// unless the producers fall behind
+		bool fused = producer->output_queue && producer->input_queue->get_size() <= producer->split_threshold;
+		if (fused)
+			transform_items(producer->transformer, &Transformer::consumer_transform_batch, batch.data(), n, stats,
+				nullptr, cache);
+
+		if (stats)
+			begin = Stats::now();
+		if (fused)
+			producer->output_queue->enqueue_bulk(batch.data(), n);
+		else
+			producer->worker_queue->enqueue_bulk(batch.data(), n);
+		if (stats) {
+			long long end = Stats::now();
+			stats->enqueue_wait.record(end - begin);
+			stats->handled(n, end);
+		}
 	}
 
 	return nullptr;
@@ -1,19 +1,22 @@
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
 #include "producer.hpp"
 
 int main() {
-	TSQueue<Item*>* q1;
-	TSQueue<Item*>* q2;
+	ItemQueue* q1;
+	WorkerQueue* q2;
+	ItemQueue* q3;
 
-	q1 = new TSQueue<Item*>;
-	q2 = new TSQueue<Item*>;
+	q1 = new ItemQueue;
+	q2 = new WorkerQueue;
+	q3 = new ItemQueue;
 
 	Transformer* transformer = new Transformer;
 
 	Reader* reader = new Reader(80, "./tests/00.in", q1);
-	Writer* writer = new Writer(80, "./tests/00.out", q2);
+	Writer* writer = new Writer(80, "./tests/00.out", q3);
 
 	Producer* p1 = new Producer(q1, q2, transformer);
 	Producer* p2 = new Producer(q1, q2, transformer);
@@ -28,8 +31,18 @@ int main() {
 	p3->start();
 	p4->start();
 
+	// the writer takes a plain ItemQueue, the worker queue may be an OpcodeQueue
+	for (int i = 0; i < 80; i++)
+		q3->enqueue(q2->dequeue());
+
 	reader->join();
 	writer->join();
+	// the stages leave once their input is closed and drained
+	q1->close();
+	p1->join();
+	p2->join();
+	p3->join();
+	p4->join();
 	
 
 	delete p2;
@@ -37,6 +50,7 @@ int main() {
 	delete transformer;
 	delete writer;
 	delete reader;
+	delete q3;
 	delete q2;
 	delete q1;
 
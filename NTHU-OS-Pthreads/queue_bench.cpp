@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "ts_queue.hpp"
+#include "lf_queue.hpp"
+#include "stats.hpp"
+
+// Contention benchmark of the queue implementations.
+// usage: ./queue_bench [ops per case] [output csv]
+// Sweeps queue x producers x consumers x capacity x payload size, every
+// thread pinned to a core round-robin, and writes one CSV line per case with
+// the handoff throughput and the latency from enqueue to dequeue.
+
+#define DEFAULT_OPS 20000
+
+// an element of payload bytes, stamped with its enqueue time
+template <int Bytes>
+struct Payload {
+	long long stamp;
+	char data[Bytes - sizeof(long long)];
+};
+
+struct Case {
+	const char* queue;
+	int producers;
+	int consumers;
+	int capacity;
+	int payload;
+	int ops;
+};
+
+struct Result {
+	double seconds;
+	// the capacity the queue ended up with, not the one asked for
+	int capacity;
+	Histogram latency;
+};
+
+template <class Queue>
+struct Shared {
+	Queue* q;
+	int ops;
+	// the number of elements not yet claimed by a consumer
+	std::atomic<int> remaining;
+	pthread_barrier_t start;
+};
+
+template <class Queue, class T>
+struct Worker {
+	pthread_t t;
+	int id;
+	Shared<Queue>* shared;
+	Histogram latency;
+	// when the thread passed the start barrier and when it was done
+	long long begin;
+	long long end;
+};
+
+static void pin(int id) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+template <class Queue, class T>
+void* produce(void* arg) {
+	Worker<Queue, T>* worker = (Worker<Queue, T>*)arg;
+	pin(worker->id);
+	pthread_barrier_wait(&worker->shared->start);
+	worker->begin = Stats::now();
+
+	T element;
+	for (int i = 0; i < worker->shared->ops; i++) {
+		element.stamp = Stats::now();
+		worker->shared->q->enqueue(element);
+	}
+	worker->end = Stats::now();
+
+	return nullptr;
+}
+
+template <class Queue, class T>
+void* consume(void* arg) {
+	Worker<Queue, T>* worker = (Worker<Queue, T>*)arg;
+	pin(worker->id);
+	pthread_barrier_wait(&worker->shared->start);
+	worker->begin = Stats::now();
+
+	while (worker->shared->remaining.fetch_sub(1) > 0) {
+		T element = worker->shared->q->dequeue();
+		worker->latency.record(Stats::now() - element.stamp);
+	}
+	worker->end = Stats::now();
+
+	return nullptr;
+}
+
+template <class Queue, class T>
+Result run(const Case& c) {
+	Shared<Queue> shared;
+	shared.q = new Queue(c.capacity);
+	shared.ops = c.ops / c.producers;
+	shared.remaining = shared.ops * c.producers;
+	pthread_barrier_init(&shared.start, NULL, c.producers + c.consumers + 1);
+
+	std::vector<Worker<Queue, T>*> workers;
+	for (int i = 0; i < c.producers + c.consumers; i++) {
+		Worker<Queue, T>* worker = new Worker<Queue, T>;
+		worker->id = i;
+		worker->shared = &shared;
+		workers.push_back(worker);
+		pthread_create(&worker->t, 0, i < c.producers ? produce<Queue, T> : consume<Queue, T>, (void*)worker);
+	}
+
+	pthread_barrier_wait(&shared.start);
+	for (Worker<Queue, T>* worker : workers)
+		pthread_join(worker->t, 0);
+
+	// from the first thread passing the barrier to the last one done
+	long long begin = workers[0]->begin, end = workers[0]->end;
+	Result result;
+	for (Worker<Queue, T>* worker : workers) {
+		begin = std::min(begin, worker->begin);
+		end = std::max(end, worker->end);
+		result.latency.merge(worker->latency);
+		delete worker;
+	}
+	result.seconds = (end - begin) / 1e9;
+	result.capacity = shared.q->get_capacity();
+
+	pthread_barrier_destroy(&shared.start);
+	delete shared.q;
+	return result;
+}
+
+template <class T>
+Result run_queue(const Case& c) {
+	if (c.queue[0] == 'l')
+		return run<LFQueue<T>, T>(c);
+	return run<TSQueue<T>, T>(c);
+}
+
+Result run_case(const Case& c) {
+	switch (c.payload) {
+	case 8:
+		return run_queue<Payload<8>>(c);
+	case 64:
+		return run_queue<Payload<64>>(c);
+	default:
+		return run_queue<Payload<256>>(c);
+	}
+}
+
+int main(int argc, char** argv) {
+	int ops = argc > 1 ? atoi(argv[1]) : DEFAULT_OPS;
+	FILE* out = argc > 2 ? fopen(argv[2], "w") : stdout;
+	assert(ops > 0 && out);
+
+	const char* queues[] = {"ts_queue", "lf_queue"};
+	int threads[] = {1, 2, 4};
+	int capacities[] = {1, 16, 200, 4000};
+	int payloads[] = {8, 64, 256};
+
+	fprintf(out, "queue,producers,consumers,capacity,payload,ops,seconds,ops_per_sec,p50_ns,p99_ns\n");
+	for (const char* queue : queues)
+		for (int producers : threads)
+			for (int consumers : threads)
+				for (int capacity : capacities)
+					for (int payload : payloads) {
+						Case c = {queue, producers, consumers, capacity, payload, ops};
+						Result r = run_case(c);
+						long long handed = r.latency.get_count();
+						fprintf(out, "%s,%d,%d,%d,%d,%lld,%.6f,%.0f,%lld,%lld\n", queue, producers, consumers,
+							r.capacity, payload, handed, r.seconds, handed / r.seconds, r.latency.percentile(50),
+							r.latency.percentile(99));
+						fflush(out);
+					}
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "thread.hpp"
+#include "item.hpp"
+#include "ts_queue.hpp"
+#include "stats.hpp"
+
+#ifndef QUEUE_SIZER_HPP
+#define QUEUE_SIZER_HPP
+
+// a queue is shrunk when its peak size over a check period stays below
+// 1 / QUEUE_SIZER_SHRINK_RATIO of its capacity
+#define QUEUE_SIZER_SHRINK_RATIO 4
+
+// Resizes TSQueues online from their occupancy. Every check period a queue
+// whose enqueues blocked on a full buffer at least grow_blocks times doubles
+// its capacity, and a queue that stayed mostly empty halves it, within the
+// bounds it was watched with. The sizer runs until all its queues are closed.
+class QueueSizer : public Thread {
+public:
+	// constructor
+	QueueSizer(int check_period, int grow_blocks);
+
+	// resize queue between min_capacity and max_capacity, set before start;
+	// name tags its capacity events in the stats
+	void watch(TSQueue<Item*>* queue, std::string name, int min_capacity, int max_capacity);
+
+	virtual void start() override;
+private:
+	struct Watched {
+		TSQueue<Item*>* queue;
+		std::string name;
+		int min_capacity;
+		int max_capacity;
+		// the blocked enqueues counted at the previous check
+		long long blocked;
+	};
+
+	// the capacity queue should have after the last period
+	static int plan(Watched& watched, int grow_blocks);
+
+	std::vector<Watched> queues;
+
+	// the time between checks in microseconds
+	int check_period;
+	// the number of blocked enqueues in a period that grows a queue
+	int grow_blocks;
+
+	// the method for pthread to create the sizer thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+QueueSizer::QueueSizer(int check_period, int grow_blocks) : check_period(check_period), grow_blocks(grow_blocks) {
+}
+
+void QueueSizer::watch(TSQueue<Item*>* queue, std::string name, int min_capacity, int max_capacity) {
+	Watched watched = {queue, name, min_capacity, max_capacity, 0};
+	queues.push_back(watched);
+}
+
+void QueueSizer::start() {
+	create(QueueSizer::process, (void*)this);
+}
+
+int QueueSizer::plan(Watched& watched, int grow_blocks) {
+	TSQueue<Item*>* queue = watched.queue;
+	int capacity = queue->get_capacity();
+	long long blocked = queue->snapshot().blocked_enqueues;
+	int peak = queue->take_peak_size();
+	long long blocks = blocked - watched.blocked;
+	watched.blocked = blocked;
+
+	if (blocks >= grow_blocks && capacity < watched.max_capacity)
+		return capacity * 2 < watched.max_capacity ? capacity * 2 : watched.max_capacity;
+	if (blocks == 0 && peak * QUEUE_SIZER_SHRINK_RATIO < capacity && capacity > watched.min_capacity)
+		return capacity / 2 > watched.min_capacity ? capacity / 2 : watched.min_capacity;
+	return capacity;
+}
+
+void* QueueSizer::process(void* arg) {
+	QueueSizer* sizer = (QueueSizer*)arg;
+
+	struct timespec period;
+	period.tv_sec = sizer->check_period / 1000000;
+	period.tv_nsec = sizer->check_period % 1000000 * 1000L;
+
+	while (true) {
+		bool open = false;
+		for (Watched& watched : sizer->queues) {
+			if (watched.queue->is_closed())
+				continue;
+			open = true;
+
+			int capacity = plan(watched, sizer->grow_blocks);
+			if (capacity != watched.queue->get_capacity()) {
+				watched.queue->resize(capacity);
+				Stats::event(watched.name + "_capacity", watched.queue->get_capacity());
+			}
+		}
+		if (!open)
+			break;
+
+		nanosleep(&period, nullptr);
+	}
+
+	return nullptr;
+}
+
+#endif // QUEUE_SIZER_HPP
@@ -1,7 +1,11 @@
 #include <fstream>
+#include <vector>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_buffer.hpp"
+#include "stats.hpp"
 
 #ifndef READER_HPP
 #define READER_HPP
@@ -9,19 +13,40 @@
 class Reader : public Thread {
 public:
 	// constructor
-	Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue);
+	Reader(int expected_lines, std::string input_file, ItemQueue* input_queue, int batch_size = 1,
+		ItemPool* pool = nullptr, ReorderBuffer* reorder = nullptr);
 
 	// destructor
 	~Reader();
 
 	virtual void start() override;
+
+	// tag every item read with a service job slot, set before start
+	void set_job(int job);
 private:
 	// the expected lines to read,
 	// the reader thread finished after input expected lines of item
 	int expected_lines;
 
 	std::ifstream ifs;
-	TSQueue<Item*>* input_queue;
+	ItemQueue* input_queue;
+
+	// the number of items handed to the input queue at once
+	int batch_size;
+
+	// where items come from, items are allocated with new when there is no pool
+	ItemPool* pool;
+
+	// the reorder buffer admitting every item for ordered output, if any
+	ReorderBuffer* reorder;
+
+	// the recorder of the reader thread, nullptr when stats are off
+	Stats::Recorder* stats;
+
+	int job;
+
+	// enqueues the first filled items of batch and empties it
+	void hand_over(Item** batch, int& filled);
 
 	// the method for pthread to create a reader thread
 	static void* process(void* arg);
@@ -29,8 +54,10 @@ private:
 
 // Implementaion start
 
-Reader::Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue)
-	: expected_lines(expected_lines), input_queue(input_queue) {
+Reader::Reader(int expected_lines, std::string input_file, ItemQueue* input_queue, int batch_size,
+	ItemPool* pool, ReorderBuffer* reorder)
+	: expected_lines(expected_lines), input_queue(input_queue), batch_size(batch_size), pool(pool),
+	  reorder(reorder), stats(nullptr), job(0) {
 	ifs = std::ifstream(input_file);
 }
 
@@ -39,19 +66,61 @@ Reader::~Reader() {
 }
 
 void Reader::start() {
-	pthread_create(&t, 0, Reader::process, (void*)this);
+	create(Reader::process, (void*)this);
+}
+
+void Reader::set_job(int job) {
+	this->job = job;
 }
 
 void* Reader::process(void* arg) {
 	Reader* reader = (Reader*)arg;
 
-	while (reader->expected_lines--) {
-		Item *item = new Item;
+	std::vector<Item*> batch(reader->batch_size);
+	ItemPool::Cache* cache = reader->pool ? new ItemPool::Cache(reader->pool) : nullptr;
+	int filled = 0;
+	reader->stats = Stats::recorder("reader");
+	long long seq = 0;
+
+	while (reader->expected_lines > 0) {
+		// hand over the partial batch before waiting for the window to move
+		// or for the Writer to return items
+		if (reader->reorder && !reader->reorder->try_admit(seq)) {
+			reader->hand_over(batch.data(), filled);
+			reader->reorder->admit(seq);
+		}
+		Item* item = cache ? cache->try_acquire() : new Item;
+		if (!item) {
+			reader->hand_over(batch.data(), filled);
+			item = cache->acquire();
+		}
+
 		reader->ifs >> *item;
-		reader->input_queue->enqueue(item);
+		item->seq = seq++;
+		item->job = reader->job;
+		batch[filled++] = item;
+		reader->expected_lines--;
+		if (filled == reader->batch_size)
+			reader->hand_over(batch.data(), filled);
 	}
+	reader->hand_over(batch.data(), filled);
+
+	delete cache;
 
 	return nullptr;
 }
 
+void Reader::hand_over(Item** batch, int& filled) {
+	if (filled == 0)
+		return;
+	long long begin = stats ? Stats::now() : 0;
+	input_queue->enqueue_bulk(batch, filled);
+	if (stats) {
+		long long end = Stats::now();
+		stats->enqueue_wait.record(end - begin);
+		stats->handled(filled, end);
+	}
+	filled = 0;
+}
+
 #endif // READER_HPP
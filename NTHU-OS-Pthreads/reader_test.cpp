@@ -1,10 +1,10 @@
 #include <unistd.h>
 #include <iostream>
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
 #include "reader.hpp"
 
 int main() {
-	TSQueue<Item*>* q = new TSQueue<Item*>;
+	ItemQueue* q = new ItemQueue;
 
 	Reader* reader = new Reader(80, "./tests/00.in", q);
 
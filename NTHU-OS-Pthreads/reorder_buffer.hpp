@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <assert.h>
+#include <atomic>
+#include <vector>
+#include "thread.hpp"
+#include "item_queue.hpp"
+#include "item.hpp"
+
+#ifndef REORDER_BUFFER_HPP
+#define REORDER_BUFFER_HPP
+
+// A stage in front of the Writer that passes items on in input order.
+// Items are held in a window of slots indexed by their sequence number until
+// every earlier item has been passed on. Readers admit each sequence number
+// before reading it, so nothing enters the pipeline more than window items
+// ahead of the oldest unfinished one and the window can never overflow.
+class ReorderBuffer : public Thread {
+public:
+	// constructor
+	ReorderBuffer(ItemQueue* input_queue, ItemQueue* output_queue, int window, int batch_size = 1);
+
+	// destructor
+	~ReorderBuffer();
+
+	virtual void start() override;
+
+	// blocks until seq fits in the window
+	void admit(long long seq);
+
+	// returns whether seq fits in the window, without blocking
+	bool try_admit(long long seq);
+private:
+	ItemQueue* input_queue;
+	ItemQueue* output_queue;
+
+	// the items waiting for earlier ones, indexed by seq % window
+	std::vector<Item*> slots;
+	int window;
+
+	// the maximum number of items moved from / to the queues at once
+	int batch_size;
+
+	// the sequence number of the next item to pass on
+	std::atomic<long long> next;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_admit;
+
+	// the method for pthread to create a reorder buffer thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+ReorderBuffer::ReorderBuffer(ItemQueue* input_queue, ItemQueue* output_queue, int window, int batch_size)
+	: input_queue(input_queue), output_queue(output_queue), slots(window, nullptr), window(window),
+	  batch_size(batch_size), next(0) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_admit, NULL);
+}
+
+ReorderBuffer::~ReorderBuffer() {
+	pthread_cond_destroy(&cond_admit);
+	pthread_mutex_destroy(&mutex);
+}
+
+void ReorderBuffer::start() {
+	create(ReorderBuffer::process, (void*)this);
+}
+
+void ReorderBuffer::admit(long long seq) {
+	if (try_admit(seq))
+		return;
+	pthread_mutex_lock(&mutex);
+	while (!try_admit(seq))
+		pthread_cond_wait(&cond_admit, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+bool ReorderBuffer::try_admit(long long seq) {
+	return seq < next.load() + window;
+}
+
+void* ReorderBuffer::process(void* arg) {
+	ReorderBuffer* rb = (ReorderBuffer*)arg;
+
+	std::vector<Item*> in(rb->batch_size), out(rb->batch_size);
+	long long next = rb->next.load();
+
+	while (true) {
+		int n = rb->input_queue->dequeue_bulk(in.data(), rb->batch_size);
+		// the input queue is closed and drained
+		if (n == 0)
+			break;
+		for (int i = 0; i < n; i++) {
+			Item*& slot = rb->slots[in[i]->seq % rb->window];
+			assert(!slot);
+			slot = in[i];
+		}
+
+		// pass on the run of items starting at next
+		int ready = 0;
+		while (rb->slots[next % rb->window]) {
+			Item*& slot = rb->slots[next % rb->window];
+			out[ready++] = slot;
+			slot = nullptr;
+			next++;
+			if (ready == rb->batch_size) {
+				rb->output_queue->enqueue_bulk(out.data(), ready);
+				ready = 0;
+			}
+		}
+		rb->output_queue->enqueue_bulk(out.data(), ready);
+
+		if (next != rb->next.load()) {
+			pthread_mutex_lock(&rb->mutex);
+			rb->next.store(next);
+			pthread_cond_broadcast(&rb->cond_admit);
+			pthread_mutex_unlock(&rb->mutex);
+		}
+	}
+
+	return nullptr;
+}
+
+#endif // REORDER_BUFFER_HPP
@@ -0,0 +1,95 @@
+#ifndef SCALING_POLICY_HPP
+#define SCALING_POLICY_HPP
+
+// the weight of the newest sample in the smoothed queue depth and growth rate
+#define CONSUMER_CONTROLLER_SMOOTHING 0.3
+// the number of check periods the controller looks ahead with the growth rate
+#define CONSUMER_CONTROLLER_HORIZON 2
+
+// The decisions of the ConsumerController, apart from its threads and its
+// clock so the simulator can replay them in virtual time.
+class ScalingPolicy {
+   public:
+    // constructor, the thresholds in items and the cooldown in microseconds
+    ScalingPolicy(int low_threshold, int high_threshold, int min_consumers, int max_consumers,
+        int cooldown_period);
+
+    // the number of consumers the controller starts with
+    int start(long long now);
+
+    // the number of consumers to run after a check at time now in
+    // microseconds that found sample items in the worker queue
+    int next(int active, int sample, long long now);
+
+   private:
+    // the number of consumers to add, negative to remove, for the sample
+    int plan(int sample);
+
+    // When the expected number of items in the worker queue is lower than
+    // low_threshold, the number of consumers is scaled down.
+    int low_threshold;
+    // When the expected number of items in the worker queue is higher than
+    // high_threshold, the number of consumers is scaled up. Nothing changes
+    // in between, so the band between the thresholds is the hysteresis.
+    int high_threshold;
+    // The bounds of the number of consumers.
+    int min_consumers;
+    int max_consumers;
+    // The time in microseconds after a scaling before the next one.
+    int cooldown_period;
+    long long last_scaled;
+
+    // the smoothed depth of the worker queue and its growth per check period
+    double depth;
+    double growth;
+};
+
+// Implementation start
+
+ScalingPolicy::ScalingPolicy(int low_threshold, int high_threshold, int min_consumers, int max_consumers,
+    int cooldown_period) : low_threshold(low_threshold),
+                           high_threshold(high_threshold),
+                           min_consumers(min_consumers),
+                           max_consumers(max_consumers),
+                           cooldown_period(cooldown_period),
+                           last_scaled(0),
+                           depth(0),
+                           growth(0) {
+}
+
+int ScalingPolicy::start(long long now) {
+    last_scaled = now;
+    return min_consumers;
+}
+
+int ScalingPolicy::next(int active, int sample, long long now) {
+    int step = plan(sample);
+    if (!step || now - last_scaled < cooldown_period)
+        return active;
+
+    int target = active + step;
+    if (target > max_consumers)
+        target = max_consumers;
+    if (target < min_consumers)
+        target = min_consumers;
+    if (target != active)
+        last_scaled = now;
+    return target;
+}
+
+int ScalingPolicy::plan(int sample) {
+    double last = depth;
+    depth += CONSUMER_CONTROLLER_SMOOTHING * (sample - depth);
+    growth += CONSUMER_CONTROLLER_SMOOTHING * ((depth - last) - growth);
+
+    // take one step per band width the expected depth is outside the band
+    double expected = depth + CONSUMER_CONTROLLER_HORIZON * growth;
+    double band = high_threshold - low_threshold > 0 ? high_threshold - low_threshold : 1;
+    if (expected > high_threshold)
+        return 1 + (int)((expected - high_threshold) / band);
+    if (expected < low_threshold)
+        return -1 - (int)((low_threshold - expected) / band);
+    return 0;
+}
+
+#endif  // SCALING_POLICY_HPP
@@ -3,60 +3,90 @@
 import click
 import json
 
-def generate_case(opcode, annotation, case_spec):
+ULLONG_MAX = 2**64 - 1
+
+def compose(case_spec):
+	# composes val -> (val * a + b) % m with itself `iterations` times by
+	# squaring, returns (fast_a, fast_b, fast_ok) for val -> (val * fast_a + fast_b) % m
+	a, b, m, n = case_spec['a'], case_spec['b'], case_spec['m'], case_spec['iterations']
+
+	# the closed form is only bit-identical when no step after the first can
+	# overflow 64 bits, the first step is checked at runtime
+	fast_ok = n > 0 and (m - 1) * a + b <= ULLONG_MAX
+
+	fast_a, fast_b = 1, 0
+	step_a, step_b = a % m, b % m
+	while n:
+		if n & 1:
+			fast_a, fast_b = fast_a * step_a % m, (fast_b * step_a + step_b) % m
+		step_a, step_b = step_a * step_a % m, (step_b * step_a + step_b) % m
+		n >>= 1
+
+	return fast_a, fast_b, fast_ok
+
+def generate_spec(opcode, annotation, case_spec):
+	fast_a, fast_b, fast_ok = compose(case_spec)
+	a, b, m = case_spec['a'], case_spec['b'], case_spec['m']
+
 	template = f'''
 	// {annotation}
-	case '{opcode}':
-		spec->a = {case_spec['a']};
-		spec->b = {case_spec['b']};
-		spec->m = {case_spec['m']};
-		spec->iterations = {case_spec['iterations']};
-		break;
-'''
-	
+	{{ '{opcode}', {a}, {b}, {m}, {case_spec['iterations']},
+	  {fast_a}, {fast_b}, {'true' if fast_ok else 'false'}, transform<{a}, {b}, {m}> }},'''
+
 	return template
 
 def generate_cpp(spec):
 	producer_spec = ''
 	for opcode in spec['annotation']:
-		producer_spec += generate_case(opcode, spec['annotation'][opcode], spec['producer'][opcode])
+		producer_spec += generate_spec(opcode, spec['annotation'][opcode], spec['producer'][opcode])
 
 	consumer_spec = ''
 	for opcode in spec['annotation']:
-		consumer_spec += generate_case(opcode, spec['annotation'][opcode], spec['consumer'][opcode])
+		consumer_spec += generate_spec(opcode, spec['annotation'][opcode], spec['consumer'][opcode])
 
 	template = f'''// CODEGEN BY auto_gen_transformer.py; DO NOT EDIT.
 
 #include <assert.h>
+#include <limits.h>
 #include "transformer.hpp"
 
-unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
+static constexpr TransformSpec producer_specs[] = {{{producer_spec}
+}};
+
+static constexpr TransformSpec consumer_specs[] = {{{consumer_spec}
+}};
 
-	switch (opcode) {{{producer_spec}
-	default:
-		assert(false);
+template <int N>
+static const TransformSpec* find_spec(const TransformSpec (&specs)[N], char opcode) {{
+	for (int i = 0; i < N; i++) {{
+		if (specs[i].opcode == opcode)
+			return &specs[i];
 	}}
+	assert(false);
+	return nullptr;
+}}
 
-	return transform(spec, val);
+unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
+	return apply(find_spec(producer_specs, opcode), val);
 }}
 
 unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
+	return apply(find_spec(consumer_specs, opcode), val);
+}}
 
-	switch (opcode) {{{consumer_spec}
-	default:
-		assert(false);
-	}}
+void Transformer::producer_transform_batch(char opcode, unsigned long long* vals, int n) {{
+	apply_batch(find_spec(producer_specs, opcode), vals, n);
+}}
 
-	return transform(spec, val);
+void Transformer::consumer_transform_batch(char opcode, unsigned long long* vals, int n) {{
+	apply_batch(find_spec(consumer_specs, opcode), vals, n);
 }}
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {{
-	while (spec->iterations--) {{
-		val = (val * spec->a + spec->b) % spec->m;
-	}}
-  return val;
+unsigned long long Transformer::apply(const TransformSpec* spec, unsigned long long val) {{
+	// the first step sees the raw input, which may still overflow
+	if (fast && spec->fast_ok && (!spec->a || val <= (ULLONG_MAX - spec->b) / spec->a))
+		return (unsigned long long)(((unsigned __int128)(val % spec->m) * spec->fast_a + spec->fast_b) % spec->m);
+	return spec->kernel(val, spec->iterations);
 }}
 '''
 
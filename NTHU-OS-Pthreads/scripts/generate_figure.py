@@ -72,9 +72,40 @@ def generate_figure(expname, worker, spec):
     plt.title(f'Exp{expname}')
     plt.savefig(f'./result/img/exp{expname}.png', bbox_inches='tight')
 
+def generate_stats_figure(events):
+    # Parse the events dumped by main with PIPELINE_STATS=1
+    series = {}
+    with open(events, 'r') as f:
+        for l in f.readlines()[1:]:
+            time, name, value = l[:-1].split(",")
+            series.setdefault(name, []).append((int(time) / 1000000, int(value))) # To get second
+
+    plt.style.use('ggplot')
+    _, ax1 = plt.subplots()
+    ax1.set_xlabel('time (s)')
+    ax1.set_ylabel('# of consumers')
+    if 'consumers' in series:
+        d = np.array(series['consumers'])
+        ax1.step(d[:, 0], d[:, 1], where='post')
+
+    ax2 = ax1.twinx()
+    ax2.set_ylabel('worker queue depth')
+    if 'worker_queue_depth' in series:
+        d = np.array(series['worker_queue_depth'])
+        ax2.plot(d[:, 0], d[:, 1], alpha=0.2)
+        ax2.fill_between(d[:, 0], d[:, 1], 0, alpha=0.1)
+    ax2.grid(False)
+
+    plt.title('Pipeline stats')
+    plt.savefig(events.rsplit('.', 1)[0] + '.png', bbox_inches='tight')
+
 if __name__ == '__main__':
     # Parsing args
     args = sys.argv[1:]
+    # stats <events.csv> plots the events of a real run
+    if len(args) >= 2 and args[0] == "stats":
+        generate_stats_figure(args[1])
+        sys.exit(0)
     expname = args[0] if len(args) >= 1 else 1
     worker = args[1] if len(args) >= 2 else "n"
     spec = list(map(int, args[2:])) if len(args) > 2 else []
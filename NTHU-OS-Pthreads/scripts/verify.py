@@ -5,10 +5,17 @@ import click
 @click.command()
 @click.option('--output', default='./transformer.cpp', help='Output file path.')
 @click.option('--answer', default='./tests/00_spec.json', help='Answer file path.')
-def verify(output, answer):
+@click.option('--ordered', is_flag=True, help='Require the output in input order.')
+def verify(output, answer, ordered):
 	with open(output, 'r') as output_f, open(answer, 'r') as answer_f:
-		output_lines = sorted(output_f.readlines())
-		answer_lines = sorted(answer_f.readlines())
+		output_lines = output_f.readlines()
+		answer_lines = answer_f.readlines()
+		if ordered:
+			# the keys of the input count up, so input order is key order
+			answer_lines = sorted(answer_lines, key=lambda line: int(line.split()[0]))
+		else:
+			output_lines = sorted(output_lines)
+			answer_lines = sorted(answer_lines)
 
 		for output_line, answer_line in zip(output_lines, answer_lines):
 			if output_line != answer_line:
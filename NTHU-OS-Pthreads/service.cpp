@@ -0,0 +1,100 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "item_queue.hpp"
+#include "worker_queue.hpp"
+#include "item_pool.hpp"
+#include "producer.hpp"
+#include "consumer_controller.hpp"
+#include "service.hpp"
+
+// Keeps the transform stages of main running and feeds them one job after
+// the other, or up to N jobs at once, without restarting any thread.
+// usage: ./service [N] < jobs
+// every line of jobs is "<n> <input> <output>", a job is reported once its
+// output is written
+
+#define READER_QUEUE_SIZE 200
+#define WORKER_QUEUE_SIZE 200
+#define WRITER_QUEUE_SIZE 4000
+#define CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE 20
+#define CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE 80
+#define CONSUMER_CONTROLLER_CHECK_PERIOD 100000
+#define CONSUMER_CONTROLLER_COOLDOWN_PERIOD 300000
+#define CONSUMER_CONTROLLER_MIN_CONSUMERS 1
+#define CONSUMER_CONTROLLER_MAX_CONSUMERS 16
+#define BATCH_SIZE 8
+#define PRODUCERS 4
+// 1 applies the closed form of each transform instead of iterating
+#ifndef TRANSFORMER_FAST_MODE
+#define TRANSFORMER_FAST_MODE 0
+#endif
+
+int main(int argc, char** argv) {
+	assert(argc <= 2);
+
+	int max_jobs = argc == 2 ? atoi(argv[1]) : 1;
+	assert(max_jobs > 0);
+
+	ItemQueue* q1 = new ItemQueue(READER_QUEUE_SIZE); // Input Queue
+	WorkerQueue* q2 = new WorkerQueue(WORKER_QUEUE_SIZE); // Worker Queue
+	ItemQueue* q3 = new ItemQueue(WRITER_QUEUE_SIZE); // Writer Queue
+
+	// every job has a writer queue of its own behind the router
+	ItemPool* pool = new ItemPool(READER_QUEUE_SIZE + WORKER_QUEUE_SIZE + WRITER_QUEUE_SIZE * (1 + max_jobs));
+
+	Transformer* transformer = new Transformer(TRANSFORMER_FAST_MODE);
+
+	std::vector<Producer*> producers;
+	for (int i = 0; i < PRODUCERS; i++)
+		producers.push_back(new Producer(q1, q2, transformer, BATCH_SIZE));
+
+	ConsumerController* cc = new ConsumerController(
+		q2,
+		q3,
+		transformer,
+		CONSUMER_CONTROLLER_CHECK_PERIOD,
+		CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100,
+		CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100,
+		BATCH_SIZE,
+		CONSUMER_CONTROLLER_MIN_CONSUMERS,
+		CONSUMER_CONTROLLER_MAX_CONSUMERS,
+		CONSUMER_CONTROLLER_COOLDOWN_PERIOD);
+
+	Service* service = new Service(q1, q3, max_jobs, WRITER_QUEUE_SIZE, BATCH_SIZE, pool);
+
+	service->start();
+	cc->start();
+	for (Producer* producer : producers)
+		producer->start();
+
+	int n;
+	std::string input_file_name, output_file_name;
+	while (std::cin >> n >> input_file_name >> output_file_name)
+		service->submit(n, input_file_name, output_file_name);
+
+	// the stages drain their input and leave as their queues are closed
+	service->drain();
+	q1->close();
+	for (Producer* producer : producers)
+		producer->join();
+	q2->close();
+	cc->join();
+	q3->close();
+	service->join();
+
+	for (Producer* producer : producers)
+		delete producer;
+	delete cc;
+	delete service;
+	delete transformer;
+	delete q1;
+	delete q2;
+	delete q3;
+	delete pool;
+
+	return 0;
+}
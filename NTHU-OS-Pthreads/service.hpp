@@ -0,0 +1,201 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "thread.hpp"
+#include "item_queue.hpp"
+#include "item.hpp"
+#include "item_pool.hpp"
+#include "ts_queue.hpp"
+#include "reader.hpp"
+#include "writer.hpp"
+
+#ifndef SERVICE_HPP
+#define SERVICE_HPP
+
+// Runs jobs through transform stages kept alive across jobs.
+// Every job gets its own Reader and Writer on a free slot, the Readers of all
+// jobs share the input queue and a router thread hands each transformed item
+// from the output queue to the Writer of the slot it was read for. Up to
+// max_jobs jobs run at once, 1 runs them back to back.
+class Service : public Thread {
+public:
+	// constructor
+	Service(ItemQueue* input_queue, ItemQueue* output_queue, int max_jobs, int job_queue_size,
+		int batch_size = 1, ItemPool* pool = nullptr);
+
+	// destructor, after the router is joined
+	~Service();
+
+	// starts the router
+	virtual void start() override;
+
+	// start a job transforming the n lines of input_file into output_file,
+	// waits for a job to complete first when every slot is taken
+	void submit(int n, std::string input_file, std::string output_file);
+
+	// wait for every submitted job to complete
+	void drain();
+private:
+	// One job, its thread runs the Reader and the Writer and reports to the
+	// completion queue once the Writer is done.
+	class Job : public Thread {
+	public:
+		// constructor
+		Job(Service* service, int id, int slot, int n, std::string input_file, std::string output_file);
+
+		virtual void start() override;
+
+		int id;
+		int slot;
+		int n;
+		std::string input_file;
+		std::string output_file;
+		// the time from start to the last write
+		double seconds;
+	private:
+		Service* service;
+
+		// the method for pthread to create a job thread
+		static void* process(void* arg);
+	};
+
+	// wait for the next job to complete, report it and free its slot
+	void complete();
+
+	static double now();
+
+	ItemQueue* input_queue;
+	ItemQueue* output_queue;
+
+	// the queue of the Writer of each slot
+	std::vector<ItemQueue*> job_queues;
+	// the slots without a running job, only used by the submitting thread
+	std::vector<int> free_slots;
+	int running;
+	int submitted;
+
+	// the jobs whose Writer is done
+	TSQueue<Job*> completed;
+
+	// the maximum number of items moved at once
+	int batch_size;
+
+	// where the Readers take items and the Writers give them back
+	ItemPool* pool;
+
+	// the method for pthread to create the router thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+Service::Service(ItemQueue* input_queue, ItemQueue* output_queue, int max_jobs, int job_queue_size,
+	int batch_size, ItemPool* pool)
+	: input_queue(input_queue), output_queue(output_queue), running(0), submitted(0), completed(max_jobs),
+	  batch_size(batch_size), pool(pool) {
+	for (int i = 0; i < max_jobs; i++) {
+		job_queues.push_back(new ItemQueue(job_queue_size));
+		free_slots.push_back(max_jobs - 1 - i);
+	}
+}
+
+Service::~Service() {
+	for (ItemQueue* queue : job_queues)
+		delete queue;
+}
+
+void Service::start() {
+	create(Service::process, (void*)this);
+}
+
+void Service::submit(int n, std::string input_file, std::string output_file) {
+	if (free_slots.empty())
+		complete();
+	int slot = free_slots.back();
+	free_slots.pop_back();
+
+	Job* job = new Job(this, submitted++, slot, n, input_file, output_file);
+	running++;
+	job->start();
+}
+
+void Service::drain() {
+	while (running > 0)
+		complete();
+}
+
+void Service::complete() {
+	Job* job = completed.dequeue();
+	job->join();
+	printf("job %d done: %d lines %s -> %s in %.3f s\n", job->id, job->n, job->input_file.c_str(),
+		job->output_file.c_str(), job->seconds);
+	fflush(stdout);
+
+	free_slots.push_back(job->slot);
+	running--;
+	delete job;
+}
+
+double Service::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void* Service::process(void* arg) {
+	Service* service = (Service*)arg;
+
+	std::vector<Item*> batch(service->batch_size);
+	std::vector<std::vector<Item*>> routed(service->job_queues.size());
+
+	// the output queue is closed after the last job
+	int n;
+	while ((n = service->output_queue->dequeue_bulk(batch.data(), service->batch_size)) > 0) {
+		for (int i = 0; i < n; i++)
+			routed[batch[i]->job].push_back(batch[i]);
+		for (int slot = 0; slot < (int)routed.size(); slot++) {
+			if (routed[slot].empty())
+				continue;
+			service->job_queues[slot]->enqueue_bulk(routed[slot].data(), routed[slot].size());
+			routed[slot].clear();
+		}
+	}
+
+	return nullptr;
+}
+
+Service::Job::Job(Service* service, int id, int slot, int n, std::string input_file, std::string output_file)
+	: id(id), slot(slot), n(n), input_file(input_file), output_file(output_file), seconds(0), service(service) {
+}
+
+void Service::Job::start() {
+	create(Service::Job::process, (void*)this);
+}
+
+void* Service::Job::process(void* arg) {
+	Job* job = (Job*)arg;
+	Service* service = job->service;
+
+	double begin = now();
+	Reader* reader = new Reader(job->n, job->input_file, service->input_queue, service->batch_size,
+		service->pool);
+	Writer* writer = new Writer(job->n, job->output_file, service->job_queues[job->slot], service->batch_size,
+		service->pool);
+	reader->set_job(job->slot);
+	reader->start();
+	writer->start();
+	reader->join();
+	writer->join();
+	job->seconds = now() - begin;
+
+	delete writer;
+	delete reader;
+
+	service->completed.enqueue(job);
+
+	return nullptr;
+}
+
+#endif // SERVICE_HPP
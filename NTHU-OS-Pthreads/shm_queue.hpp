@@ -0,0 +1,224 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <type_traits>
+
+#ifndef SHM_QUEUE_HPP
+#define SHM_QUEUE_HPP
+
+// A bounded queue in a named POSIX shared memory object, so processes that
+// open the same name share it. Elements are stored by value, T must be
+// copyable with memcpy, and the mutex and condition variables are process
+// shared. The interface follows TSQueue.
+template <class T>
+class ShmQueue {
+	static_assert(std::is_trivially_copyable<T>::value, "ShmQueue elements are copied between processes as bytes");
+public:
+	// constructor, creates the shared memory object name with room for
+	// max_buffer_size elements, name must not exist yet
+	ShmQueue(std::string name, int max_buffer_size);
+
+	// constructor, opens the queue another process created as name
+	explicit ShmQueue(std::string name);
+
+	// destructor, unmaps the queue, which lives on until it is unlinked
+	// and every process has unmapped it
+	~ShmQueue();
+
+	// remove the name, processes that opened it keep using the queue
+	void unlink();
+
+	// add n elements to the end of the queue, moving as many as fit per
+	// critical section with one wakeup
+	void enqueue_bulk(const T* items, int n);
+
+	// remove up to max elements from the head of the queue into items,
+	// blocks until at least one is available and returns the number removed,
+	// 0 once the queue is closed and empty
+	int dequeue_bulk(T* items, int max);
+
+	// return the number of elements in the queue
+	int get_size();
+
+	// mark the end of the input, after the last enqueue
+	void close();
+
+	// return whether close was called
+	bool is_closed();
+
+	// return the number of times the queue was opened by name, so its
+	// creator can unlink it once every process it expects has it mapped
+	int get_openers();
+private:
+	// the state shared by all processes, followed by the buffer
+	struct Shared {
+		pthread_mutex_t mutex;
+		pthread_cond_t cond_enqueue, cond_dequeue;
+		int buffer_size;
+		int size;
+		int head;
+		int tail;
+		bool closed;
+		int openers;
+	};
+
+	// the offset of the buffer, a cache line after the shared state
+	static size_t buffer_offset();
+
+	// map the object behind fd
+	void map(int fd);
+
+	std::string name;
+	size_t mapped_size;
+	Shared* shared;
+	T* buffer;
+};
+
+// Implementation start
+
+template <class T>
+ShmQueue<T>::ShmQueue(std::string name, int max_buffer_size) : name(name) {
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	assert(fd >= 0);
+	mapped_size = buffer_offset() + sizeof(T) * max_buffer_size;
+	int ret = ftruncate(fd, mapped_size);
+	assert(ret == 0);
+	map(fd);
+
+	pthread_mutexattr_t mutex_attr;
+	pthread_mutexattr_init(&mutex_attr);
+	pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&shared->mutex, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
+
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+	pthread_cond_init(&shared->cond_enqueue, &cond_attr);
+	pthread_cond_init(&shared->cond_dequeue, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+
+	shared->buffer_size = max_buffer_size;
+	shared->size = 0;
+	shared->head = 0;
+	shared->tail = 0;
+	shared->closed = false;
+	shared->openers = 0;
+}
+
+template <class T>
+ShmQueue<T>::ShmQueue(std::string name) : name(name) {
+	int fd = shm_open(name.c_str(), O_RDWR, 0600);
+	assert(fd >= 0);
+	struct stat st;
+	fstat(fd, &st);
+	mapped_size = st.st_size;
+	map(fd);
+
+	pthread_mutex_lock(&shared->mutex);
+	shared->openers++;
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+template <class T>
+ShmQueue<T>::~ShmQueue() {
+	munmap((void*)shared, mapped_size);
+}
+
+template <class T>
+void ShmQueue<T>::unlink() {
+	shm_unlink(name.c_str());
+}
+
+template <class T>
+size_t ShmQueue<T>::buffer_offset() {
+	return (sizeof(Shared) + 63) / 64 * 64;
+}
+
+template <class T>
+void ShmQueue<T>::map(int fd) {
+	void* addr = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	assert(addr != MAP_FAILED);
+	::close(fd);
+	shared = (Shared*)addr;
+	buffer = (T*)((char*)addr + buffer_offset());
+}
+
+template <class T>
+void ShmQueue<T>::enqueue_bulk(const T* items, int n) {
+	pthread_mutex_lock(&shared->mutex);
+	while (n > 0) {
+		while (shared->size == shared->buffer_size)
+			pthread_cond_wait(&shared->cond_enqueue, &shared->mutex);
+		int moved = 0;
+		while (moved < n && shared->size < shared->buffer_size) {
+			buffer[shared->tail] = items[moved++];
+			shared->tail = (shared->tail + 1) % shared->buffer_size;
+			shared->size++;
+		}
+		items += moved;
+		n -= moved;
+		if (moved == 1)
+			pthread_cond_signal(&shared->cond_dequeue);
+		else
+			pthread_cond_broadcast(&shared->cond_dequeue);
+	}
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+template <class T>
+int ShmQueue<T>::dequeue_bulk(T* items, int max) {
+	pthread_mutex_lock(&shared->mutex);
+	while (shared->size == 0 && !shared->closed)
+		pthread_cond_wait(&shared->cond_dequeue, &shared->mutex);
+	int moved = 0;
+	while (moved < max && shared->size > 0) {
+		items[moved++] = buffer[shared->head];
+		shared->head = (shared->head + 1) % shared->buffer_size;
+		shared->size--;
+	}
+	if (moved == 1)
+		pthread_cond_signal(&shared->cond_enqueue);
+	else if (moved > 1)
+		pthread_cond_broadcast(&shared->cond_enqueue);
+	pthread_mutex_unlock(&shared->mutex);
+	return moved;
+}
+
+template <class T>
+int ShmQueue<T>::get_size() {
+	pthread_mutex_lock(&shared->mutex);
+	int ret = shared->size;
+	pthread_mutex_unlock(&shared->mutex);
+	return ret;
+}
+
+template <class T>
+void ShmQueue<T>::close() {
+	pthread_mutex_lock(&shared->mutex);
+	shared->closed = true;
+	pthread_cond_broadcast(&shared->cond_dequeue);
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+template <class T>
+bool ShmQueue<T>::is_closed() {
+	pthread_mutex_lock(&shared->mutex);
+	bool ret = shared->closed;
+	pthread_mutex_unlock(&shared->mutex);
+	return ret;
+}
+
+template <class T>
+int ShmQueue<T>::get_openers() {
+	pthread_mutex_lock(&shared->mutex);
+	int ret = shared->openers;
+	pthread_mutex_unlock(&shared->mutex);
+	return ret;
+}
+
+#endif // SHM_QUEUE_HPP
@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "item.hpp"
+#include "ts_queue.hpp"
+#include "transformer.hpp"
+#include "scaling_policy.hpp"
+
+// Simulates the split pipeline of main in virtual time to tune the consumer
+// controller without running the transforms. The time of each transform is
+// measured once per opcode of the input with the linked transformer, then
+// every combination of the given parameters is replayed in milliseconds:
+// the reader fills the input queue, the producers and the active consumers
+// share SIM_CORES cores, and the controller is the same ScalingPolicy on the
+// same checks. The writer is taken as free.
+// usage: ./sim <n> <input> <reader sizes> <worker sizes> <low %s> <high %s> <check periods> [timeline csv]
+// every parameter is a comma-separated list, e.g. 100000,1000000 for the
+// check period in microseconds. Prints one CSV line per combination, the
+// timeline csv gets the number of consumers after every scaling.
+
+#define PRODUCERS 4
+#define BATCH_SIZE 8
+#define CONSUMER_CONTROLLER_COOLDOWN_PERIOD 300000
+#define CONSUMER_CONTROLLER_MIN_CONSUMERS 1
+#define CONSUMER_CONTROLLER_MAX_CONSUMERS 16
+// the cores the stage threads run on, 0 for the online cpus
+#ifndef SIM_CORES
+#define SIM_CORES 0
+#endif
+
+struct Config {
+	int reader_queue_size;
+	int worker_queue_size;
+	int low_threshold_percentage;
+	int high_threshold_percentage;
+	int check_period;
+};
+
+struct Result {
+	double seconds;
+	double mean_latency;
+	double p99_latency;
+	int peak_consumers;
+	int scalings;
+};
+
+// a producer or a consumer thread
+struct Worker {
+	bool producer;
+	// the items of the batch being transformed, or finished and waiting for
+	// room in the worker queue
+	std::vector<int> items;
+	// the cpu time left in ns, 0 once the batch is transformed
+	double remaining;
+};
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static std::vector<int> parse_list(const char* list) {
+	std::vector<int> values;
+	std::string s(list);
+	size_t begin = 0;
+	while (begin <= s.size()) {
+		size_t end = s.find(',', begin);
+		if (end == std::string::npos)
+			end = s.size();
+		if (end > begin)
+			values.push_back(atoi(s.substr(begin, end - begin).c_str()));
+		begin = end + 1;
+	}
+	return values;
+}
+
+// the time of one producer and one consumer transform of each opcode, in ns
+static void measure(std::vector<Item>& items, double* producer_ns, double* consumer_ns) {
+	Transformer transformer;
+	volatile unsigned long long sink = 0;
+	for (int op = 0; op < 256; op++)
+		producer_ns[op] = consumer_ns[op] = -1;
+	for (Item& item : items) {
+		unsigned char op = item.opcode;
+		if (producer_ns[op] >= 0)
+			continue;
+		double begin = now();
+		sink += transformer.producer_transform(item.opcode, item.val);
+		producer_ns[op] = now() - begin;
+		begin = now();
+		sink += transformer.consumer_transform(item.opcode, item.val);
+		consumer_ns[op] = now() - begin;
+		fprintf(stderr, "opcode %c: producer %.3f ms, consumer %.3f ms\n", item.opcode, producer_ns[op] / 1e6,
+			consumer_ns[op] / 1e6);
+	}
+}
+
+static Result simulate(Config config, std::vector<Item>& items, double* producer_ns, double* consumer_ns, int cores,
+	FILE* timeline, int id) {
+	int n = items.size();
+	TSQueue<int> input_queue(config.reader_queue_size);
+	TSQueue<int> worker_queue(config.worker_queue_size);
+	ScalingPolicy policy(config.low_threshold_percentage * config.worker_queue_size / 100,
+		config.high_threshold_percentage * config.worker_queue_size / 100, CONSUMER_CONTROLLER_MIN_CONSUMERS,
+		CONSUMER_CONTROLLER_MAX_CONSUMERS, CONSUMER_CONTROLLER_COOLDOWN_PERIOD);
+
+	std::vector<Worker> workers(PRODUCERS + CONSUMER_CONTROLLER_MAX_CONSUMERS);
+	for (int i = 0; i < (int)workers.size(); i++) {
+		workers[i].producer = i < PRODUCERS;
+		workers[i].remaining = 0;
+	}
+
+	Result result = {0, 0, 0, 0, 0};
+	std::vector<double> read_at(n), latencies;
+	latencies.reserve(n);
+	int read = 0;
+	double time = 0;
+	double next_check = 0;
+	int active = policy.start(0);
+	result.peak_consumers = active;
+	if (timeline)
+		fprintf(timeline, "%d,0,%d\n", id, active);
+
+	std::vector<int> batch(BATCH_SIZE);
+	while ((int)latencies.size() < n) {
+		// hand items on until every stage waits on a queue or a transform
+		bool moved = true;
+		while (moved) {
+			moved = false;
+			while (read < n && input_queue.get_size() < input_queue.get_capacity()) {
+				read_at[read] = time;
+				input_queue.enqueue(read++);
+				moved = true;
+			}
+			for (int i = 0; i < (int)workers.size(); i++) {
+				Worker& w = workers[i];
+				if (w.producer && !w.items.empty() && w.remaining == 0) {
+					int room = worker_queue.get_capacity() - worker_queue.get_size();
+					int put = std::min(room, (int)w.items.size());
+					if (put > 0) {
+						worker_queue.enqueue_bulk(w.items.data(), put);
+						w.items.erase(w.items.begin(), w.items.begin() + put);
+						moved = true;
+					}
+				}
+				if (!w.items.empty() || (!w.producer && i - PRODUCERS >= active))
+					continue;
+				TSQueue<int>& queue = w.producer ? input_queue : worker_queue;
+				int taken = queue.try_dequeue_bulk(batch.data(), BATCH_SIZE);
+				for (int k = 0; k < taken; k++) {
+					unsigned char op = items[batch[k]].opcode;
+					w.items.push_back(batch[k]);
+					w.remaining += w.producer ? producer_ns[op] : consumer_ns[op];
+				}
+				if (taken > 0)
+					moved = true;
+			}
+		}
+
+		// the busy threads share the cores evenly
+		int busy = 0;
+		for (Worker& w : workers)
+			if (w.remaining > 0)
+				busy++;
+		double rate = busy > cores ? (double)cores / busy : 1;
+
+		double step = next_check - time;
+		for (Worker& w : workers)
+			if (w.remaining > 0 && w.remaining / rate < step)
+				step = w.remaining / rate;
+		time += step;
+
+		for (Worker& w : workers) {
+			if (w.remaining <= 0)
+				continue;
+			w.remaining -= step * rate;
+			if (w.remaining > 1e-6)
+				continue;
+			w.remaining = 0;
+			if (!w.producer) {
+				for (int item : w.items)
+					latencies.push_back(time - read_at[item]);
+				w.items.clear();
+			}
+		}
+
+		if (time >= next_check) {
+			int target = policy.next(active, worker_queue.get_size(), (long long)(time / 1000));
+			if (target != active) {
+				active = target;
+				result.scalings++;
+				result.peak_consumers = std::max(result.peak_consumers, active);
+				if (timeline)
+					fprintf(timeline, "%d,%.3f,%d\n", id, time / 1e6, active);
+			}
+			next_check += config.check_period * 1000.0;
+		}
+	}
+
+	result.seconds = time / 1e9;
+	std::sort(latencies.begin(), latencies.end());
+	double sum = 0;
+	for (double latency : latencies)
+		sum += latency;
+	result.mean_latency = sum / n / 1e6;
+	result.p99_latency = latencies[(size_t)(n * 0.99) < latencies.size() ? (size_t)(n * 0.99) : n - 1] / 1e6;
+	return result;
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 8 || argc == 9);
+
+	int n = atoi(argv[1]);
+	std::ifstream input(argv[2]);
+	std::vector<Item> items;
+	Item item;
+	while ((int)items.size() < n && input >> item)
+		items.push_back(item);
+	assert(!items.empty());
+
+	std::vector<int> reader_sizes = parse_list(argv[3]);
+	std::vector<int> worker_sizes = parse_list(argv[4]);
+	std::vector<int> lows = parse_list(argv[5]);
+	std::vector<int> highs = parse_list(argv[6]);
+	std::vector<int> periods = parse_list(argv[7]);
+	FILE* timeline = argc == 9 ? fopen(argv[8], "w") : nullptr;
+	if (timeline)
+		fprintf(timeline, "run,time_ms,consumers\n");
+
+	int cores = SIM_CORES > 0 ? SIM_CORES : sysconf(_SC_NPROCESSORS_ONLN);
+	double producer_ns[256], consumer_ns[256];
+	measure(items, producer_ns, consumer_ns);
+
+	printf("run,reader_queue_size,worker_queue_size,low_threshold_percentage,high_threshold_percentage,"
+		"check_period,seconds,items_per_sec,mean_latency_ms,p99_latency_ms,peak_consumers,scalings,sim_ms\n");
+	int id = 0;
+	for (int reader_size : reader_sizes)
+	for (int worker_size : worker_sizes)
+	for (int low : lows)
+	for (int high : highs)
+	for (int period : periods) {
+		Config config = {reader_size, worker_size, low, high, period};
+		double begin = now();
+		Result r = simulate(config, items, producer_ns, consumer_ns, cores, timeline, id);
+		printf("%d,%d,%d,%d,%d,%d,%.3f,%.0f,%.3f,%.3f,%d,%d,%.1f\n", id, reader_size, worker_size, low, high,
+			period, r.seconds, items.size() / r.seconds, r.mean_latency, r.p99_latency, r.peak_consumers,
+			r.scalings, (now() - begin) / 1e6);
+		fflush(stdout);
+		id++;
+	}
+
+	if (timeline)
+		fclose(timeline);
+	return 0;
+}
@@ -0,0 +1,266 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+// the number of sub-buckets per power of 2 in a Histogram, the relative error
+// of a recorded value is below 1 / HISTOGRAM_SUB_BUCKETS
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+// the opcodes with their own transform histogram, 'A' to 'Z'
+#define STATS_OPCODES 26
+
+// HDR-style histogram of non-negative values with log-linear buckets,
+// recording is a few instructions and never allocates.
+class Histogram {
+public:
+	// constructor
+	Histogram();
+
+	// count value times times
+	void record(long long value, long long times = 1);
+
+	// add the values recorded by other
+	void merge(const Histogram& other);
+
+	// the number of values recorded
+	long long get_count();
+
+	// the mean of the values recorded
+	double get_mean();
+
+	// the smallest bucket bound below which at least p percent of the values lie
+	long long percentile(double p);
+
+	// the largest value recorded
+	long long get_max();
+private:
+	static int bucket_of(long long value);
+	static long long lower_bound(int bucket);
+
+	long long counts[HISTOGRAM_BUCKETS];
+	long long count;
+	long long sum;
+	long long max;
+};
+
+// Pipeline instrumentation, off unless enabled before the stages start.
+// Every stage thread registers its own Recorder and writes to it without
+// locking; queue depth samples and controller actions go to a shared event
+// log with monotonic timestamps. dump writes everything as CSV at exit.
+class Stats {
+public:
+	// The measurements of one stage thread, only written by that thread.
+	class Recorder {
+	public:
+		// constructor
+		explicit Recorder(std::string stage);
+
+		// count n items handled at time now, for the throughput
+		void handled(int n, long long now);
+
+		std::string stage;
+		// the time spent blocked in queue operations, in ns
+		Histogram enqueue_wait;
+		Histogram dequeue_wait;
+		// the time per item of each transform, in ns, by opcode
+		Histogram transform[STATS_OPCODES];
+
+		long long items;
+		// the times of the first and the last handled items
+		long long first;
+		long long last;
+	};
+
+	// start recording
+	static void enable();
+
+	// a new Recorder for the calling thread, nullptr when not enabled
+	static Recorder* recorder(std::string stage);
+
+	// log an event with the current time, ignored when not enabled
+	static void event(std::string name, long long value);
+
+	// write the histograms to stats_file and the events to events_file
+	static void dump(std::string stats_file, std::string events_file);
+
+	// the monotonic time in ns
+	static long long now();
+private:
+	struct Event {
+		long long time;
+		std::string name;
+		long long value;
+	};
+
+	struct State {
+		bool enabled;
+		long long start;
+		std::vector<Recorder*> recorders;
+		std::vector<Event> events;
+		pthread_mutex_t mutex;
+	};
+
+	static State& state();
+};
+
+// Implementation start
+
+Histogram::Histogram() : count(0), sum(0), max(0) {
+	memset(counts, 0, sizeof(counts));
+}
+
+int Histogram::bucket_of(long long value) {
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return value < 0 ? 0 : (int)value;
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+long long Histogram::lower_bound(int bucket) {
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+	int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return (long long)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+void Histogram::record(long long value, long long times) {
+	counts[bucket_of(value)] += times;
+	count += times;
+	sum += value * times;
+	if (value > max)
+		max = value;
+}
+
+void Histogram::merge(const Histogram& other) {
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		counts[i] += other.counts[i];
+	count += other.count;
+	sum += other.sum;
+	if (other.max > max)
+		max = other.max;
+}
+
+long long Histogram::get_count() {
+	return count;
+}
+
+double Histogram::get_mean() {
+	return count ? (double)sum / count : 0;
+}
+
+long long Histogram::percentile(double p) {
+	long long target = (long long)(count * p / 100);
+	long long seen = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen > target)
+			return lower_bound(i);
+	}
+	return max;
+}
+
+long long Histogram::get_max() {
+	return max;
+}
+
+Stats::Recorder::Recorder(std::string stage) : stage(stage), items(0), first(0), last(0) {
+}
+
+void Stats::Recorder::handled(int n, long long now) {
+	if (items == 0)
+		first = now;
+	items += n;
+	last = now;
+}
+
+Stats::State& Stats::state() {
+	static State state = {false, 0, {}, {}, PTHREAD_MUTEX_INITIALIZER};
+	return state;
+}
+
+void Stats::enable() {
+	state().start = now();
+	state().enabled = true;
+}
+
+Stats::Recorder* Stats::recorder(std::string stage) {
+	State& s = state();
+	if (!s.enabled)
+		return nullptr;
+	Recorder* recorder = new Recorder(stage);
+	pthread_mutex_lock(&s.mutex);
+	s.recorders.push_back(recorder);
+	pthread_mutex_unlock(&s.mutex);
+	return recorder;
+}
+
+void Stats::event(std::string name, long long value) {
+	State& s = state();
+	if (!s.enabled)
+		return;
+	Event event = {now() - s.start, name, value};
+	pthread_mutex_lock(&s.mutex);
+	s.events.push_back(event);
+	pthread_mutex_unlock(&s.mutex);
+}
+
+void Stats::dump(std::string stats_file, std::string events_file) {
+	State& s = state();
+	if (!s.enabled)
+		return;
+	pthread_mutex_lock(&s.mutex);
+
+	// the stages may still be running, the numbers are a snapshot
+	FILE* f = fopen(stats_file.c_str(), "w");
+	if (f) {
+		fprintf(f, "stage,thread,metric,count,mean_ns,p50_ns,p90_ns,p99_ns,max_ns,items_per_sec\n");
+		for (int i = 0; i < (int)s.recorders.size(); i++) {
+			Recorder* r = s.recorders[i];
+			double seconds = (r->last - r->first) / 1e9;
+			double rate = seconds > 0 ? r->items / seconds : 0;
+
+			std::vector<std::pair<std::string, Histogram*>> metrics;
+			metrics.push_back(std::make_pair(std::string("enqueue_wait"), &r->enqueue_wait));
+			metrics.push_back(std::make_pair(std::string("dequeue_wait"), &r->dequeue_wait));
+			for (int op = 0; op < STATS_OPCODES; op++)
+				metrics.push_back(std::make_pair(std::string("transform_") + (char)('A' + op), &r->transform[op]));
+
+			for (auto& metric : metrics) {
+				Histogram* h = metric.second;
+				if (!h->get_count())
+					continue;
+				fprintf(f, "%s,%d,%s,%lld,%.0f,%lld,%lld,%lld,%lld,%.0f\n", r->stage.c_str(), i,
+					metric.first.c_str(), h->get_count(), h->get_mean(), h->percentile(50), h->percentile(90),
+					h->percentile(99), h->get_max(), rate);
+			}
+		}
+		fclose(f);
+	}
+
+	f = fopen(events_file.c_str(), "w");
+	if (f) {
+		fprintf(f, "time_us,event,value\n");
+		for (Event& event : s.events)
+			fprintf(f, "%lld,%s,%lld\n", event.time / 1000, event.name.c_str(), event.value);
+		fclose(f);
+	}
+
+	pthread_mutex_unlock(&s.mutex);
+}
+
+long long Stats::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif // STATS_HPP
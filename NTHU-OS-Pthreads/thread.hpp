@@ -1,10 +1,18 @@
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 
 #ifndef THREAD_HPP
 #define THREAD_HPP
 
 class Thread {
 public:
+	virtual ~Thread() {}
+
 	// to start a new pthread work
 	virtual void start() = 0;
 
@@ -13,8 +21,20 @@ public:
 
 	// to cancel the pthread work
 	virtual int cancel();
+
+	// to run the pthread work only on the given cpus, set before start,
+	// an empty list leaves the placement to the OS
+	void set_affinity(std::vector<int> cpus);
 protected:
+	// to create the pthread running routine(arg) on the cpus of set_affinity,
+	// unpinned with a warning when the cpus are rejected, e.g. outside the
+	// cpuset, and aborting when no thread can be created at all
+	int create(void* (*routine)(void*), void* arg);
+
 	pthread_t t;
+
+	// the cpus the pthread may run on, all when empty
+	std::vector<int> cpus;
 };
 
 int Thread::join() {
@@ -25,4 +45,39 @@ int Thread::cancel() {
 	return pthread_cancel(t);
 }
 
+void Thread::set_affinity(std::vector<int> cpus) {
+	this->cpus = cpus;
+}
+
+int Thread::create(void* (*routine)(void*), void* arg) {
+	int ret = EINVAL;
+	if (!cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus) {
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		}
+
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		ret = pthread_create(&t, &attr, routine, arg);
+		pthread_attr_destroy(&attr);
+		if (ret != 0) {
+			fprintf(stderr, "warning: cannot pin a thread to cpus");
+			for (int cpu : cpus)
+				fprintf(stderr, " %d", cpu);
+			fprintf(stderr, " (%s), leaving it unpinned\n", strerror(ret));
+		}
+	}
+	if (ret != 0)
+		ret = pthread_create(&t, 0, routine, arg);
+	if (ret != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+		abort();
+	}
+	return ret;
+}
+
 #endif // THREAD_HPP
@@ -0,0 +1,148 @@
+#include <immintrin.h>
+#include "transformer.hpp"
+
+// Batch kernels running the recurrence of one spec on several values side by
+// side, one value per SIMD lane. The lanes need the values already reduced
+// below m, each step computes t = val * a + b with a 32x32 -> 64-bit multiply
+// and reduces it with a floating-point estimate of t / m corrected by at most
+// one m, which is exact as long as t < 2^52. The kernels take b reduced below
+// m too, so the quotient t / m stays below a and fits the 32-bit multiply.
+
+typedef void (*BatchKernel)(unsigned long long* vals, int n, unsigned long long a,
+	unsigned long long b, unsigned long long m, int iterations);
+
+// 2^52 as double and its bit pattern, used to convert between the integer
+// and double representations of values below 2^52
+#define MAGIC_BITS 0x4330000000000000ULL
+#define MAGIC_DOUBLE 4503599627370496.0
+
+// the number of values in flight per loop in the SIMD kernels, two
+// independent vectors hide the latency of the dependent chain
+#define AVX2_BLOCK 8
+#define AVX512_BLOCK 16
+
+// below this many values the constant-modulus scalar kernel is faster
+#define BATCH_KERNEL_MIN_VALUES 4
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_step(__m256i x, __m256i a, __m256i b, __m256i m, __m256i m_minus_1, __m256d inv_m) {
+	const __m256i magic_bits = _mm256_set1_epi64x(MAGIC_BITS);
+	const __m256d magic_double = _mm256_set1_pd(MAGIC_DOUBLE);
+
+	__m256i t = _mm256_add_epi64(_mm256_mul_epu32(x, a), b);
+	__m256d t_double = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(t, magic_bits)), magic_double);
+	__m256d q_double = _mm256_floor_pd(_mm256_mul_pd(t_double, inv_m));
+	__m256i q = _mm256_xor_si256(_mm256_castpd_si256(_mm256_add_pd(q_double, magic_double)), magic_bits);
+
+	__m256i r = _mm256_sub_epi64(t, _mm256_mul_epu32(q, m));
+	r = _mm256_add_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(_mm256_setzero_si256(), r), m));
+	r = _mm256_sub_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(r, m_minus_1), m));
+	return r;
+}
+
+__attribute__((target("avx2")))
+static void avx2_kernel(unsigned long long* vals, int n, unsigned long long a,
+	unsigned long long b, unsigned long long m, int iterations) {
+	const __m256i va = _mm256_set1_epi64x(a);
+	const __m256i vb = _mm256_set1_epi64x(b);
+	const __m256i vm = _mm256_set1_epi64x(m);
+	const __m256i vm_minus_1 = _mm256_set1_epi64x(m - 1);
+	const __m256d inv_m = _mm256_set1_pd(1.0 / (double)m);
+
+	for (int i = 0; i < n; i += AVX2_BLOCK) {
+		int lanes = n - i < AVX2_BLOCK ? n - i : AVX2_BLOCK;
+		unsigned long long block[AVX2_BLOCK] = {0};
+		for (int j = 0; j < lanes; j++)
+			block[j] = vals[i + j];
+
+		__m256i x0 = _mm256_loadu_si256((__m256i*)block);
+		__m256i x1 = _mm256_loadu_si256((__m256i*)(block + 4));
+		for (int k = 0; k < iterations; k++) {
+			x0 = avx2_step(x0, va, vb, vm, vm_minus_1, inv_m);
+			x1 = avx2_step(x1, va, vb, vm, vm_minus_1, inv_m);
+		}
+		_mm256_storeu_si256((__m256i*)block, x0);
+		_mm256_storeu_si256((__m256i*)(block + 4), x1);
+
+		for (int j = 0; j < lanes; j++)
+			vals[i + j] = block[j];
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i avx512_step(__m512i x, __m512i a, __m512i b, __m512i m, __m512i m_minus_1, __m512d inv_m) {
+	const __m512i magic_bits = _mm512_set1_epi64(MAGIC_BITS);
+	const __m512d magic_double = _mm512_set1_pd(MAGIC_DOUBLE);
+
+	__m512i t = _mm512_add_epi64(_mm512_mul_epu32(x, a), b);
+	__m512d t_double = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(t, magic_bits)), magic_double);
+	__m512d q_double = _mm512_roundscale_pd(_mm512_mul_pd(t_double, inv_m), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	__m512i q = _mm512_xor_si512(_mm512_castpd_si512(_mm512_add_pd(q_double, magic_double)), magic_bits);
+
+	__m512i r = _mm512_sub_epi64(t, _mm512_mul_epu32(q, m));
+	r = _mm512_mask_add_epi64(r, _mm512_cmpgt_epi64_mask(_mm512_setzero_si512(), r), r, m);
+	r = _mm512_mask_sub_epi64(r, _mm512_cmpgt_epi64_mask(r, m_minus_1), r, m);
+	return r;
+}
+
+__attribute__((target("avx512f")))
+static void avx512_kernel(unsigned long long* vals, int n, unsigned long long a,
+	unsigned long long b, unsigned long long m, int iterations) {
+	const __m512i va = _mm512_set1_epi64(a);
+	const __m512i vb = _mm512_set1_epi64(b);
+	const __m512i vm = _mm512_set1_epi64(m);
+	const __m512i vm_minus_1 = _mm512_set1_epi64(m - 1);
+	const __m512d inv_m = _mm512_set1_pd(1.0 / (double)m);
+
+	for (int i = 0; i < n; i += AVX512_BLOCK) {
+		int lanes = n - i < AVX512_BLOCK ? n - i : AVX512_BLOCK;
+		unsigned long long block[AVX512_BLOCK] = {0};
+		for (int j = 0; j < lanes; j++)
+			block[j] = vals[i + j];
+
+		__m512i x0 = _mm512_loadu_si512(block);
+		__m512i x1 = _mm512_loadu_si512(block + 8);
+		for (int k = 0; k < iterations; k++) {
+			x0 = avx512_step(x0, va, vb, vm, vm_minus_1, inv_m);
+			x1 = avx512_step(x1, va, vb, vm, vm_minus_1, inv_m);
+		}
+		_mm512_storeu_si512(block, x0);
+		_mm512_storeu_si512(block + 8, x1);
+
+		for (int j = 0; j < lanes; j++)
+			vals[i + j] = block[j];
+	}
+}
+
+static BatchKernel select_batch_kernel() {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return avx512_kernel;
+	if (__builtin_cpu_supports("avx2"))
+		return avx2_kernel;
+	return nullptr;
+}
+
+// the widest kernel this CPU runs, nullptr when there is none
+static const BatchKernel batch_kernel = select_batch_kernel();
+
+// whether every step after the first fits the lanes of the batch kernels,
+// given b % m in place of b
+static bool fits_batch_kernel(const TransformSpec* spec) {
+	const unsigned long long limit = 1ULL << 52;
+	return spec->iterations > 0 && spec->a < (1ULL << 32) && spec->m < (1ULL << 32)
+		&& (spec->m - 1) * spec->a < limit - spec->b % spec->m;
+}
+
+void Transformer::apply_batch(const TransformSpec* spec, unsigned long long* vals, int n) {
+	if (fast || n < BATCH_KERNEL_MIN_VALUES || !batch_kernel || !fits_batch_kernel(spec)) {
+		for (int i = 0; i < n; i++)
+			vals[i] = apply(spec, vals[i]);
+		return;
+	}
+
+	// the first step sees the raw input, which may be above m or overflow
+	for (int i = 0; i < n; i++)
+		vals[i] = (vals[i] * spec->a + spec->b) % spec->m;
+	batch_kernel(vals, n, spec->a, spec->b % spec->m, spec->m, spec->iterations - 1);
+}
@@ -0,0 +1,209 @@
+#include <pthread.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#ifndef TRANSFORM_CACHE_HPP
+#define TRANSFORM_CACHE_HPP
+
+// Memoizes transform results by (stage, opcode, val), so a repeated pair costs
+// a lookup instead of another run of the recurrence. Off unless enabled
+// before the stages start, like Stats.
+// The entries are split over shards by the hash of the key, each shard a
+// fixed ring of slots under its own mutex with an index into it. A full
+// shard evicts with CLOCK: the hand sweeps the ring, clearing the referenced
+// bit a hit sets, and replaces the first entry not hit since the last sweep.
+class TransformCache {
+public:
+	// the transform a result belongs to
+	enum Stage {
+		PRODUCER = 0,
+		CONSUMER = 1,
+		STAGES = 2
+	};
+
+	// constructor, room for at least capacity results over shards shards
+	TransformCache(int capacity, int shards);
+
+	// destructor
+	~TransformCache();
+
+	// set result to the cached transform of val and return true on a hit
+	bool lookup(Stage stage, char opcode, unsigned long long val, unsigned long long* result);
+
+	// cache result as the transform of val, evicting an entry if needed
+	void insert(Stage stage, char opcode, unsigned long long val, unsigned long long result);
+
+	// the lookups of stage that hit and missed so far
+	long long get_hits(Stage stage);
+	long long get_misses(Stage stage);
+
+	// the entries evicted so far
+	long long get_evictions();
+
+	// create the process-wide cache
+	static void enable(int capacity, int shards);
+
+	// the process-wide cache, nullptr when not enabled
+	static TransformCache* instance();
+private:
+	struct Key {
+		int stage;
+		char opcode;
+		unsigned long long val;
+
+		bool operator==(const Key& other) const;
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const;
+	};
+
+	struct Slot {
+		Key key;
+		unsigned long long result;
+		// set by a hit, cleared when the hand passes
+		bool referenced;
+		bool used;
+	};
+
+	// allocated one by one, so the mutexes of shards do not share a line
+	struct Shard {
+		pthread_mutex_t mutex;
+		std::vector<Slot> slots;
+		std::unordered_map<Key, int, KeyHash> index;
+		int hand;
+	};
+
+	Shard& shard_of(const Key& key);
+
+	std::vector<Shard*> shards;
+
+	std::atomic<long long> hits[STAGES];
+	std::atomic<long long> misses[STAGES];
+	std::atomic<long long> evictions;
+
+	static TransformCache*& global();
+};
+
+// Implementation start
+
+bool TransformCache::Key::operator==(const Key& other) const {
+	return stage == other.stage && opcode == other.opcode && val == other.val;
+}
+
+size_t TransformCache::KeyHash::operator()(const Key& key) const {
+	// the finalizer of splitmix64, so nearby values spread over shards
+	unsigned long long h = key.val ^ ((unsigned long long)(unsigned char)key.opcode << 56) ^
+		((unsigned long long)key.stage << 48);
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+TransformCache::TransformCache(int capacity, int shards) : evictions(0) {
+	if (shards < 1)
+		shards = 1;
+	int per_shard = (capacity + shards - 1) / shards;
+	if (per_shard < 1)
+		per_shard = 1;
+	for (int i = 0; i < shards; i++) {
+		Shard* shard = new Shard();
+		pthread_mutex_init(&shard->mutex, nullptr);
+		shard->slots.resize(per_shard);
+		for (Slot& slot : shard->slots)
+			slot.referenced = slot.used = false;
+		shard->index.reserve(per_shard);
+		shard->hand = 0;
+		this->shards.push_back(shard);
+	}
+	for (int s = 0; s < STAGES; s++) {
+		hits[s].store(0, std::memory_order_relaxed);
+		misses[s].store(0, std::memory_order_relaxed);
+	}
+}
+
+TransformCache::~TransformCache() {
+	for (Shard* shard : shards) {
+		pthread_mutex_destroy(&shard->mutex);
+		delete shard;
+	}
+}
+
+TransformCache::Shard& TransformCache::shard_of(const Key& key) {
+	// the high bits pick the shard, the low bits the bucket in its index
+	return *shards[(KeyHash()(key) >> 32) % shards.size()];
+}
+
+bool TransformCache::lookup(Stage stage, char opcode, unsigned long long val, unsigned long long* result) {
+	Key key = {stage, opcode, val};
+	Shard& shard = shard_of(key);
+	pthread_mutex_lock(&shard.mutex);
+	auto it = shard.index.find(key);
+	bool hit = it != shard.index.end();
+	if (hit) {
+		Slot& slot = shard.slots[it->second];
+		slot.referenced = true;
+		*result = slot.result;
+	}
+	pthread_mutex_unlock(&shard.mutex);
+
+	(hit ? hits : misses)[stage].fetch_add(1, std::memory_order_relaxed);
+	return hit;
+}
+
+void TransformCache::insert(Stage stage, char opcode, unsigned long long val, unsigned long long result) {
+	Key key = {stage, opcode, val};
+	Shard& shard = shard_of(key);
+	pthread_mutex_lock(&shard.mutex);
+	// another thread missed on the same key and got here first
+	if (shard.index.count(key)) {
+		pthread_mutex_unlock(&shard.mutex);
+		return;
+	}
+
+	int size = shard.slots.size();
+	while (shard.slots[shard.hand].referenced) {
+		shard.slots[shard.hand].referenced = false;
+		shard.hand = (shard.hand + 1) % size;
+	}
+	Slot& slot = shard.slots[shard.hand];
+	if (slot.used) {
+		shard.index.erase(slot.key);
+		evictions.fetch_add(1, std::memory_order_relaxed);
+	}
+	slot.key = key;
+	slot.result = result;
+	slot.used = true;
+	shard.index[key] = shard.hand;
+	shard.hand = (shard.hand + 1) % size;
+	pthread_mutex_unlock(&shard.mutex);
+}
+
+long long TransformCache::get_hits(Stage stage) {
+	return hits[stage].load(std::memory_order_relaxed);
+}
+
+long long TransformCache::get_misses(Stage stage) {
+	return misses[stage].load(std::memory_order_relaxed);
+}
+
+long long TransformCache::get_evictions() {
+	return evictions.load(std::memory_order_relaxed);
+}
+
+TransformCache*& TransformCache::global() {
+	static TransformCache* cache = nullptr;
+	return cache;
+}
+
+void TransformCache::enable(int capacity, int shards) {
+	if (!global())
+		global() = new TransformCache(capacity, shards);
+}
+
+TransformCache* TransformCache::instance() {
+	return global();
+}
+
+#endif // TRANSFORM_CACHE_HPP
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "transform_cache.hpp"
+
+#define THREADS 4
+#define KEYS 1000
+#define ROUNDS 100
+
+TransformCache* shared;
+
+// a stand-in transform, so every cached result can be checked
+unsigned long long fake_transform(char opcode, unsigned long long val) {
+	return val * 31 + opcode;
+}
+
+// Looks up keys from several threads at once, filling the misses,
+// every hit must return the result inserted for its key.
+void* hammer(void* arg) {
+	unsigned int seed = (unsigned long)arg;
+	for (int i = 0; i < KEYS * ROUNDS; i++) {
+		unsigned long long val = rand_r(&seed) % KEYS;
+		char opcode = 'A' + rand_r(&seed) % 4;
+		unsigned long long result;
+		if (shared->lookup(TransformCache::PRODUCER, opcode, val, &result))
+			assert(result == fake_transform(opcode, val));
+		else
+			shared->insert(TransformCache::PRODUCER, opcode, val, fake_transform(opcode, val));
+	}
+	return nullptr;
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 1);
+
+	// one shard of 3: 1 is hit before 4 arrives, so the hand passes it and
+	// evicts 2 instead, then 3 makes way for 5
+	TransformCache cache(3, 1);
+	unsigned long long result;
+	for (int val = 1; val <= 3; val++)
+		cache.insert(TransformCache::PRODUCER, 'A', val, val * 10);
+	cache.lookup(TransformCache::PRODUCER, 'A', 1, &result);
+	cache.insert(TransformCache::PRODUCER, 'A', 4, 40);
+	cache.insert(TransformCache::PRODUCER, 'A', 5, 50);
+	// cached: 1=10 4=40 5=50, consumer miss, 2 evictions
+	printf("cached:");
+	for (int val = 1; val <= 5; val++) {
+		if (cache.lookup(TransformCache::PRODUCER, 'A', val, &result))
+			printf(" %d=%llu", val, result);
+	}
+	// the stages do not share results
+	printf(", consumer %s", cache.lookup(TransformCache::CONSUMER, 'A', 1, &result) ? "hit" : "miss");
+	printf(", %lld evictions\n", cache.get_evictions());
+
+	shared = new TransformCache(KEYS, 16);
+	pthread_t threads[THREADS];
+	for (long i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], nullptr, hammer, (void*)(i + 1));
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(threads[i], nullptr);
+	printf("%d threads: %lld hits %lld misses %lld evictions\n", THREADS, shared->get_hits(TransformCache::PRODUCER),
+		shared->get_misses(TransformCache::PRODUCER), shared->get_evictions());
+	delete shared;
+
+	return 0;
+}
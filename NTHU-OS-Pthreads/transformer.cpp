@@ -1,113 +1,74 @@
 // CODEGEN BY auto_gen_transformer.py; DO NOT EDIT.
 
 #include <assert.h>
+#include <limits.h>
 #include "transformer.hpp"
 
-unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
-
-	switch (opcode) {
+static constexpr TransformSpec producer_specs[] = {
 	// same speed
-	case 'A':
-		spec->a = 2003;
-		spec->b = 183492;
-		spec->m = 1000000007;
-		spec->iterations = 9000000;
-		break;
-
+	{ 'A', 2003, 183492, 1000000007, 9000000,
+	  21405405, 447412772, true, transform<2003, 183492, 1000000007> },
 	// consumer faster than producer
-	case 'B':
-		spec->a = 2143;
-		spec->b = 191324;
-		spec->m = 1000000009;
-		spec->iterations = 12000000;
-		break;
-
+	{ 'B', 2143, 191324, 1000000009, 12000000,
+	  265889483, 801605421, true, transform<2143, 191324, 1000000009> },
 	// producer faster than consumer
-	case 'C':
-		spec->a = 2089;
-		spec->b = 923134;
-		spec->m = 1000000021;
-		spec->iterations = 5000000;
-		break;
-
+	{ 'C', 2089, 923134, 1000000021, 5000000,
+	  735679530, 293473216, true, transform<2089, 923134, 1000000021> },
 	// producer slightly faster than consumer
-	case 'D':
-		spec->a = 2677;
-		spec->b = 912834;
-		spec->m = 1000000033;
-		spec->iterations = 7000000;
-		break;
-
+	{ 'D', 2677, 912834, 1000000033, 7000000,
+	  117588548, 701352852, true, transform<2677, 912834, 1000000033> },
 	// consumer slightly faster than producer
-	case 'E':
-		spec->a = 2693;
-		spec->b = 718341;
-		spec->m = 1000000087;
-		spec->iterations = 12000000;
-		break;
-
-	default:
-		assert(false);
-	}
-
-	return transform(spec, val);
-}
+	{ 'E', 2693, 718341, 1000000087, 12000000,
+	  754315625, 834989864, true, transform<2693, 718341, 1000000087> },
+};
 
-unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
-
-	switch (opcode) {
+static constexpr TransformSpec consumer_specs[] = {
 	// same speed
-	case 'A':
-		spec->a = 2729;
-		spec->b = 713423;
-		spec->m = 1000000093;
-		spec->iterations = 9000000;
-		break;
-
+	{ 'A', 2729, 713423, 1000000093, 9000000,
+	  578006788, 431927332, true, transform<2729, 713423, 1000000093> },
 	// consumer faster than producer
-	case 'B':
-		spec->a = 2617;
-		spec->b = 193424;
-		spec->m = 1000000097;
-		spec->iterations = 5000000;
-		break;
-
+	{ 'B', 2617, 193424, 1000000097, 5000000,
+	  814701443, 186084281, true, transform<2617, 193424, 1000000097> },
 	// producer faster than consumer
-	case 'C':
-		spec->a = 2053;
-		spec->b = 743142;
-		spec->m = 1000000103;
-		spec->iterations = 12000000;
-		break;
-
+	{ 'C', 2053, 743142, 1000000103, 12000000,
+	  694646855, 926510429, true, transform<2053, 743142, 1000000103> },
 	// producer slightly faster than consumer
-	case 'D':
-		spec->a = 2347;
-		spec->b = 617345;
-		spec->m = 1000000123;
-		spec->iterations = 12000000;
-		break;
-
+	{ 'D', 2347, 617345, 1000000123, 12000000,
+	  146939271, 984745424, true, transform<2347, 617345, 1000000123> },
 	// consumer slightly faster than producer
-	case 'E':
-		spec->a = 2521;
-		spec->b = 4719832;
-		spec->m = 1000000181;
-		spec->iterations = 7000000;
-		break;
-
-	default:
-		assert(false);
+	{ 'E', 2521, 4719832, 1000000181, 7000000,
+	  14784063, 759633585, true, transform<2521, 4719832, 1000000181> },
+};
+
+template <int N>
+static const TransformSpec* find_spec(const TransformSpec (&specs)[N], char opcode) {
+	for (int i = 0; i < N; i++) {
+		if (specs[i].opcode == opcode)
+			return &specs[i];
 	}
+	assert(false);
+	return nullptr;
+}
 
-	return transform(spec, val);
+unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {
+	return apply(find_spec(producer_specs, opcode), val);
 }
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {
-	while (spec->iterations--) {
-		val = (val * spec->a + spec->b) % spec->m;
-	}
-  return val;
+unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {
+	return apply(find_spec(consumer_specs, opcode), val);
+}
+
+void Transformer::producer_transform_batch(char opcode, unsigned long long* vals, int n) {
+	apply_batch(find_spec(producer_specs, opcode), vals, n);
+}
+
+void Transformer::consumer_transform_batch(char opcode, unsigned long long* vals, int n) {
+	apply_batch(find_spec(consumer_specs, opcode), vals, n);
+}
+
+unsigned long long Transformer::apply(const TransformSpec* spec, unsigned long long val) {
+	// the first step sees the raw input, which may still overflow
+	if (fast && spec->fast_ok && (!spec->a || val <= (ULLONG_MAX - spec->b) / spec->a))
+		return (unsigned long long)(((unsigned __int128)(val % spec->m) * spec->fast_a + spec->fast_b) % spec->m);
+	return spec->kernel(val, spec->iterations);
 }
@@ -2,16 +2,39 @@
 #ifndef TRANSFORMER_HPP
 #define TRANSFORMER_HPP
 
+// runs the recurrence of one spec for the given number of iterations
+typedef unsigned long long (*TransformKernel)(unsigned long long val, int iterations);
+
 struct TransformSpec {
+  char opcode;
   unsigned long long a;
   unsigned long long b;
   unsigned long long m;
   int iterations;
+  // the whole recurrence composed into val -> (val * fast_a + fast_b) % m,
+  // exact as long as fast_ok holds and the first step does not overflow
+  unsigned long long fast_a;
+  unsigned long long fast_b;
+  bool fast_ok;
+  // transform<a, b, m> instantiated for this spec
+  TransformKernel kernel;
 };
 
+// The recurrence with the spec baked in at compile time,
+// so the compiler turns % m into a multiply and shifts.
+template <unsigned long long a, unsigned long long b, unsigned long long m>
+unsigned long long transform(unsigned long long val, int iterations) {
+  while (iterations--) {
+    val = (val * a + b) % m;
+  }
+  return val;
+}
+
 class Transformer {
 public:
-  Transformer() {};
+  Transformer() : fast(false) {};
+  // fast applies the precomputed closed form instead of iterating
+  explicit Transformer(bool fast) : fast(fast) {};
   ~Transformer() {};
 
   // the producer's work
@@ -20,8 +43,21 @@ public:
   // the consumer's work
   unsigned long long consumer_transform(char opcode, unsigned long long val);
 
+  // the producer's work on n values sharing one opcode, in place
+  void producer_transform_batch(char opcode, unsigned long long* vals, int n);
+
+  // the consumer's work on n values sharing one opcode, in place
+  void consumer_transform_batch(char opcode, unsigned long long* vals, int n);
+
 private:
-  unsigned long long transform(TransformSpec* spec, unsigned long long val);
+  // runs the kernel of spec, or its closed form in fast mode when that is exact
+  unsigned long long apply(const TransformSpec* spec, unsigned long long val);
+
+  // runs spec on all values at once in SIMD lanes when the CPU and the spec
+  // allow it, one by one through apply otherwise (transform_batch.cpp)
+  void apply_batch(const TransformSpec* spec, unsigned long long* vals, int n);
+
+  bool fast;
 };
 
 #endif // TRANSFORMER_HPP
@@ -1,15 +1,49 @@
 #include <pthread.h>
 #include <stdio.h>
+#include <time.h>
+#include <atomic>
 #include <iostream>
+#include <new>
+#include <utility>
 
 #ifndef TS_QUEUE_HPP
 #define TS_QUEUE_HPP
 
 #define DEFAULT_BUFFER_SIZE 200
 
+// the depth histogram of a TSQueue has a bucket for an empty queue and one
+// per power of 2 above
+#define TS_QUEUE_DEPTH_BUCKETS 32
+// the depth is sampled once every TS_QUEUE_DEPTH_SAMPLE_PERIOD changes
+#define TS_QUEUE_DEPTH_SAMPLE_PERIOD 16
+
+// Elements live by value in one contiguous ring and are only constructed
+// while queued, so T needs neither a default constructor nor copies: a
+// move-only T goes in with emplace or an rvalue and comes out moved.
 template <class T>
 class TSQueue {
 public:
+	// The counters of a queue since it was created. Each is exact, but they
+	// are read one after the other without locking the queue, so they may be
+	// a few operations apart.
+	struct Snapshot {
+		int size;
+		int capacity;
+		// the largest size ever reached
+		int peak_size;
+		long long enqueued;
+		long long dequeued;
+		// the number of times an enqueue waited for room, and for how long
+		long long blocked_enqueues;
+		long long enqueue_wait_ns;
+		// the number of times a dequeue waited for an element, and for how long
+		long long blocked_dequeues;
+		long long dequeue_wait_ns;
+		// sampled sizes, bucket 0 counts an empty queue and bucket i > 0 the
+		// sizes in [2^(i-1), 2^i)
+		long long depth_histogram[TS_QUEUE_DEPTH_BUCKETS];
+	};
+
 	// constructor
 	TSQueue();
 
@@ -21,22 +55,107 @@ public:
 	// add an element to the end of the queue (tail)
 	void enqueue(T item);
 
-	// remove and return the first element of the queue (head)
+	// construct an element from args in place at the end of the queue
+	template <class... Args>
+	void emplace(Args&&... args);
+
+	// remove and return the first element of the queue (head),
+	// or T() once the queue is closed and empty
 	T dequeue();
 
-	// return the number of elements in the queue
+	// move the first element into item, blocks until one is available,
+	// returns false once the queue is closed and empty
+	bool wait_dequeue(T& item);
+
+	// move the first element into item without blocking,
+	// returns false when the queue is empty
+	bool try_dequeue(T& item);
+
+	// add n elements to the end of the queue, moving as many as fit per
+	// critical section with one wakeup; the elements are moved from
+	void enqueue_bulk(T* items, int n);
+
+	// remove up to max elements from the head of the queue into items,
+	// blocks until at least one is available and returns the number removed,
+	// 0 once the queue is closed and empty
+	int dequeue_bulk(T* items, int max);
+
+	// remove up to max elements from the head of the queue into items
+	// without blocking, returns the number removed which may be 0
+	int try_dequeue_bulk(T* items, int max);
+
+	// return the number of elements in the queue, without locking
 	int get_size();
+
+	// mark the end of the input, after the last enqueue: the remaining
+	// elements are still dequeued and then every dequeue returns at once
+	void close();
+
+	// return whether close was called
+	bool is_closed();
+
+	// change the capacity to max_buffer_size, or to the current size if more
+	// elements are queued, keeping them in order; blocked enqueues resume
+	// when it grows
+	void resize(int max_buffer_size);
+
+	// return the capacity
+	int get_capacity();
+
+	// return the counters, without locking
+	Snapshot snapshot();
+
+	// return the largest size since the last call, and start over from the
+	// current size
+	int take_peak_size();
 private:
+	// wait while the queue is full, counting the wait
+	void wait_for_room();
+
+	// wait while the queue is empty and open, counting the wait
+	void wait_for_elements();
+
+	// count in elements enqueued and out dequeued and publish the new size,
+	// under the mutex
+	void update(int in, int out);
+
+	// move the head element into item and destroy its slot, under the mutex
+	void pop(T& item);
+
+	// storage for buffer_size elements, none of them constructed
+	static T* allocate(int buffer_size);
+
+	static long long now();
 	// the maximum buffer size
 	int buffer_size;
-	// the buffer containing values of the queue
+	// the buffer containing values of the queue, only the slots from head
+	// to tail hold constructed elements
 	T* buffer;
-	// the current size of the buffer
+	// the current size of the buffer, and its copy for readers without the lock
 	int size;
+	std::atomic<int> published_size;
 	// the index of first item in the queue
 	int head;
 	// the index of last item in the queue
 	int tail;
+	// whether no more elements will be enqueued
+	bool closed;
+
+	// the counters of the snapshot, only written under the mutex so a
+	// relaxed load and store replace a locked increment
+	std::atomic<int> capacity;
+	std::atomic<int> peak_size;
+	std::atomic<long long> enqueued;
+	std::atomic<long long> dequeued;
+	std::atomic<long long> blocked_enqueues;
+	std::atomic<long long> enqueue_wait_ns;
+	std::atomic<long long> blocked_dequeues;
+	std::atomic<long long> dequeue_wait_ns;
+	std::atomic<long long> depth_histogram[TS_QUEUE_DEPTH_BUCKETS];
+	// the number of changes, to sample the depth
+	int changes;
+	// the largest size since take_peak_size
+	int window_peak_size;
 
 	// pthread mutex lock
 	pthread_mutex_t mutex;
@@ -53,10 +172,24 @@ TSQueue<T>::TSQueue() : TSQueue(DEFAULT_BUFFER_SIZE) {
 template <class T>
 TSQueue<T>::TSQueue(int buffer_size) : buffer_size(buffer_size) {
 	// TODO: implements TSQueue constructor
-	buffer = new T [buffer_size];
+	buffer = allocate(buffer_size);
 	size = 0;
 	head = 0;
 	tail = 0;
+	closed = false;
+	published_size = 0;
+	capacity = buffer_size;
+	peak_size = 0;
+	enqueued = 0;
+	dequeued = 0;
+	blocked_enqueues = 0;
+	enqueue_wait_ns = 0;
+	blocked_dequeues = 0;
+	dequeue_wait_ns = 0;
+	for (int i = 0; i < TS_QUEUE_DEPTH_BUCKETS; i++)
+		depth_histogram[i] = 0;
+	changes = 0;
+	window_peak_size = 0;
 	// Initialize mutex and CVs
 	pthread_mutex_init(&mutex, NULL);
 	pthread_cond_init(&cond_enqueue, NULL);
@@ -66,7 +199,9 @@ TSQueue<T>::TSQueue(int buffer_size) : buffer_size(buffer_size) {
 template <class T>
 TSQueue<T>::~TSQueue() {
 	// TODO: implenents TSQueue destructor
-	delete [] buffer;
+	for (int i = 0; i < size; i++)
+		buffer[(head + i) % buffer_size].~T();
+	::operator delete(buffer);
 	pthread_cond_destroy(&cond_enqueue);
 	pthread_cond_destroy(&cond_dequeue);
 	pthread_mutex_destroy(&mutex);
@@ -75,12 +210,18 @@ TSQueue<T>::~TSQueue() {
 template <class T>
 void TSQueue<T>::enqueue(T item) {
 	// TODO: enqueues an element to the end of the queue
+	emplace(std::move(item));
+}
+
+template <class T>
+template <class... Args>
+void TSQueue<T>::emplace(Args&&... args) {
 	pthread_mutex_lock(&mutex);
-	while (size == buffer_size) 
-		pthread_cond_wait(&cond_enqueue, &mutex);
-	buffer[tail] = item;
+	wait_for_room();
+	new (&buffer[tail]) T(std::forward<Args>(args)...);
 	tail = (tail + 1) % buffer_size;
 	size++;
+	update(1, 0);
 	pthread_cond_signal(&cond_dequeue);
 	pthread_mutex_unlock(&mutex);
 }
@@ -89,20 +230,250 @@ template <class T>
 T TSQueue<T>::dequeue() {
 	// TODO: dequeues the first element of the queue
 	pthread_mutex_lock(&mutex);
-	while (size == 0) 
-		pthread_cond_wait(&cond_dequeue, &mutex);	
-	T element = buffer[head];
+	wait_for_elements();
+	if (size == 0) {
+		pthread_mutex_unlock(&mutex);
+		return T();
+	}
+	T element(std::move(buffer[head]));
+	buffer[head].~T();
 	head = (head + 1) % buffer_size;	
 	size--;
+	update(0, 1);
 	pthread_cond_signal(&cond_enqueue);
 	pthread_mutex_unlock(&mutex);
 	return element;
 }
 
+template <class T>
+bool TSQueue<T>::wait_dequeue(T& item) {
+	pthread_mutex_lock(&mutex);
+	wait_for_elements();
+	bool popped = size > 0;
+	if (popped) {
+		pop(item);
+		update(0, 1);
+		pthread_cond_signal(&cond_enqueue);
+	}
+	pthread_mutex_unlock(&mutex);
+	return popped;
+}
+
+template <class T>
+bool TSQueue<T>::try_dequeue(T& item) {
+	pthread_mutex_lock(&mutex);
+	bool popped = size > 0;
+	if (popped) {
+		pop(item);
+		update(0, 1);
+		pthread_cond_signal(&cond_enqueue);
+	}
+	pthread_mutex_unlock(&mutex);
+	return popped;
+}
+
+template <class T>
+void TSQueue<T>::enqueue_bulk(T* items, int n) {
+	pthread_mutex_lock(&mutex);
+	while (n > 0) {
+		wait_for_room();
+		int moved = 0;
+		while (moved < n && size < buffer_size) {
+			new (&buffer[tail]) T(std::move(items[moved++]));
+			tail = (tail + 1) % buffer_size;
+			size++;
+		}
+		update(moved, 0);
+		items += moved;
+		n -= moved;
+		if (moved == 1)
+			pthread_cond_signal(&cond_dequeue);
+		else
+			pthread_cond_broadcast(&cond_dequeue);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T>
+int TSQueue<T>::dequeue_bulk(T* items, int max) {
+	pthread_mutex_lock(&mutex);
+	wait_for_elements();
+	int moved = 0;
+	while (moved < max && size > 0) {
+		pop(items[moved++]);
+	}
+	if (moved > 0)
+		update(0, moved);
+	if (moved == 1)
+		pthread_cond_signal(&cond_enqueue);
+	else if (moved > 1)
+		pthread_cond_broadcast(&cond_enqueue);
+	pthread_mutex_unlock(&mutex);
+	return moved;
+}
+
+template <class T>
+int TSQueue<T>::try_dequeue_bulk(T* items, int max) {
+	pthread_mutex_lock(&mutex);
+	int moved = 0;
+	while (moved < max && size > 0) {
+		pop(items[moved++]);
+	}
+	if (moved > 0)
+		update(0, moved);
+	if (moved == 1)
+		pthread_cond_signal(&cond_enqueue);
+	else if (moved > 1)
+		pthread_cond_broadcast(&cond_enqueue);
+	pthread_mutex_unlock(&mutex);
+	return moved;
+}
+
 template <class T>
 int TSQueue<T>::get_size() {
 	// TODO: returns the size of the queue
-	return size;
+	return published_size.load(std::memory_order_relaxed);
+}
+
+template <class T>
+void TSQueue<T>::close() {
+	pthread_mutex_lock(&mutex);
+	closed = true;
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T>
+bool TSQueue<T>::is_closed() {
+	pthread_mutex_lock(&mutex);
+	bool ret = closed;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+template <class T>
+void TSQueue<T>::resize(int max_buffer_size) {
+	pthread_mutex_lock(&mutex);
+	int capacity = max_buffer_size > size ? max_buffer_size : size;
+	if (capacity < 1)
+		capacity = 1;
+	if (capacity != buffer_size) {
+		T* resized = allocate(capacity);
+		for (int i = 0; i < size; i++) {
+			T& element = buffer[(head + i) % buffer_size];
+			new (&resized[i]) T(std::move(element));
+			element.~T();
+		}
+		::operator delete(buffer);
+		buffer = resized;
+		head = 0;
+		tail = size % capacity;
+		if (capacity > buffer_size)
+			pthread_cond_broadcast(&cond_enqueue);
+		buffer_size = capacity;
+		this->capacity.store(capacity, std::memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T>
+int TSQueue<T>::get_capacity() {
+	return capacity.load(std::memory_order_relaxed);
+}
+
+template <class T>
+typename TSQueue<T>::Snapshot TSQueue<T>::snapshot() {
+	Snapshot s;
+	// dequeued before enqueued, so enqueued - dequeued is never negative
+	s.dequeued = dequeued.load(std::memory_order_acquire);
+	s.enqueued = enqueued.load(std::memory_order_acquire);
+	s.size = get_size();
+	s.capacity = get_capacity();
+	s.peak_size = peak_size.load(std::memory_order_relaxed);
+	s.blocked_enqueues = blocked_enqueues.load(std::memory_order_relaxed);
+	s.enqueue_wait_ns = enqueue_wait_ns.load(std::memory_order_relaxed);
+	s.blocked_dequeues = blocked_dequeues.load(std::memory_order_relaxed);
+	s.dequeue_wait_ns = dequeue_wait_ns.load(std::memory_order_relaxed);
+	for (int i = 0; i < TS_QUEUE_DEPTH_BUCKETS; i++)
+		s.depth_histogram[i] = depth_histogram[i].load(std::memory_order_relaxed);
+	return s;
+}
+
+template <class T>
+int TSQueue<T>::take_peak_size() {
+	pthread_mutex_lock(&mutex);
+	int peak = window_peak_size;
+	window_peak_size = size;
+	pthread_mutex_unlock(&mutex);
+	return peak;
+}
+
+// add n to a counter only written under the mutex
+template <class C>
+static inline void ts_queue_add(std::atomic<C>& counter, C n) {
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+template <class T>
+void TSQueue<T>::wait_for_room() {
+	if (size < buffer_size)
+		return;
+	long long begin = now();
+	while (size == buffer_size)
+		pthread_cond_wait(&cond_enqueue, &mutex);
+	ts_queue_add(blocked_enqueues, 1LL);
+	ts_queue_add(enqueue_wait_ns, now() - begin);
+}
+
+template <class T>
+void TSQueue<T>::wait_for_elements() {
+	if (size > 0 || closed)
+		return;
+	long long begin = now();
+	while (size == 0 && !closed)
+		pthread_cond_wait(&cond_dequeue, &mutex);
+	ts_queue_add(blocked_dequeues, 1LL);
+	ts_queue_add(dequeue_wait_ns, now() - begin);
+}
+
+template <class T>
+void TSQueue<T>::update(int in, int out) {
+	if (in)
+		ts_queue_add(enqueued, (long long)in);
+	if (out)
+		ts_queue_add(dequeued, (long long)out);
+	published_size.store(size, std::memory_order_relaxed);
+	if (size > peak_size.load(std::memory_order_relaxed))
+		peak_size.store(size, std::memory_order_relaxed);
+	if (size > window_peak_size)
+		window_peak_size = size;
+
+	if (++changes % TS_QUEUE_DEPTH_SAMPLE_PERIOD == 0) {
+		int bucket = size == 0 ? 0 : 32 - __builtin_clz(size);
+		if (bucket >= TS_QUEUE_DEPTH_BUCKETS)
+			bucket = TS_QUEUE_DEPTH_BUCKETS - 1;
+		ts_queue_add(depth_histogram[bucket], 1LL);
+	}
+}
+
+template <class T>
+void TSQueue<T>::pop(T& item) {
+	item = std::move(buffer[head]);
+	buffer[head].~T();
+	head = (head + 1) % buffer_size;
+	size--;
+}
+
+template <class T>
+T* TSQueue<T>::allocate(int buffer_size) {
+	return static_cast<T*>(::operator new(sizeof(T) * buffer_size));
+}
+
+template <class T>
+long long TSQueue<T>::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 #endif // TS_QUEUE_HPP
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "thread.hpp"
+#include "item.hpp"
+#include "transformer.hpp"
+#include "batch_transform.hpp"
+#include "writer.hpp"
+
+#ifndef VALUE_STAGES_HPP
+#define VALUE_STAGES_HPP
+
+// The stages of the by-value pipeline, where the Items live in the ring
+// buffers of the queues and in the batches of the stages, never on the heap.
+// Queue is TSQueue<Item> within a process or ShmQueue<Item> across
+// processes, anything with enqueue_bulk and a dequeue_bulk returning 0 once
+// closed and empty.
+
+// Parses the input into the queue. The queue is not closed, its owner closes
+// it after joining every reader.
+template <class Queue>
+class ValueReader : public Thread {
+public:
+	// constructor
+	ValueReader(int expected_lines, std::string input_file, Queue* queue, int batch_size = 1);
+
+	virtual void start() override;
+
+	// read until expected_lines or the end of the input, in the calling thread
+	void run();
+private:
+	int expected_lines;
+	std::string input_file;
+	Queue* queue;
+	int batch_size;
+
+	// the method for pthread to create a reader thread
+	static void* process(void* arg);
+};
+
+// Applies both transforms to the items of the input queue and hands them to
+// the output queue, until the input queue is closed and drained.
+template <class Queue>
+class ValueWorker : public Thread {
+public:
+	// constructor
+	ValueWorker(Queue* input_queue, Queue* output_queue, Transformer* transformer, int batch_size = 1);
+
+	virtual void start() override;
+
+	// work in the calling thread
+	void run();
+private:
+	Queue* input_queue;
+	Queue* output_queue;
+	Transformer* transformer;
+	int batch_size;
+
+	// the method for pthread to create a worker thread
+	static void* process(void* arg);
+};
+
+// Writes the items of the queue until expected_lines are written or the
+// queue is closed and drained.
+template <class Queue>
+class ValueWriter : public Thread {
+public:
+	// constructor
+	ValueWriter(int expected_lines, std::string output_file, Queue* queue, int batch_size = 1,
+		int flush_threshold = DEFAULT_FLUSH_THRESHOLD);
+
+	virtual void start() override;
+
+	// write in the calling thread
+	void run();
+private:
+	int expected_lines;
+	std::string output_file;
+	Queue* queue;
+	int batch_size;
+	int flush_threshold;
+
+	// the method for pthread to create a writer thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+template <class Queue>
+ValueReader<Queue>::ValueReader(int expected_lines, std::string input_file, Queue* queue, int batch_size)
+	: expected_lines(expected_lines), input_file(input_file), queue(queue), batch_size(batch_size) {
+}
+
+template <class Queue>
+void ValueReader<Queue>::start() {
+	create(ValueReader<Queue>::process, (void*)this);
+}
+
+template <class Queue>
+void ValueReader<Queue>::run() {
+	std::ifstream input(input_file);
+	std::vector<Item> batch(batch_size);
+	int read = 0;
+	while (read < expected_lines) {
+		int filled = 0;
+		while (filled < batch_size && read < expected_lines && input >> batch[filled]) {
+			batch[filled].seq = read++;
+			filled++;
+		}
+		if (filled == 0)
+			break;
+		queue->enqueue_bulk(batch.data(), filled);
+	}
+}
+
+template <class Queue>
+void* ValueReader<Queue>::process(void* arg) {
+	((ValueReader<Queue>*)arg)->run();
+	return nullptr;
+}
+
+template <class Queue>
+ValueWorker<Queue>::ValueWorker(Queue* input_queue, Queue* output_queue, Transformer* transformer, int batch_size)
+	: input_queue(input_queue), output_queue(output_queue), transformer(transformer), batch_size(batch_size) {
+}
+
+template <class Queue>
+void ValueWorker<Queue>::start() {
+	create(ValueWorker<Queue>::process, (void*)this);
+}
+
+template <class Queue>
+void ValueWorker<Queue>::run() {
+	std::vector<Item> items(batch_size);
+	std::vector<Item*> pointers(batch_size);
+	for (int i = 0; i < batch_size; i++)
+		pointers[i] = &items[i];
+
+	int n;
+	while ((n = input_queue->dequeue_bulk(items.data(), batch_size)) > 0) {
+		transform_items(transformer, &Transformer::producer_transform_batch, pointers.data(), n);
+		transform_items(transformer, &Transformer::consumer_transform_batch, pointers.data(), n);
+		output_queue->enqueue_bulk(items.data(), n);
+	}
+}
+
+template <class Queue>
+void* ValueWorker<Queue>::process(void* arg) {
+	((ValueWorker<Queue>*)arg)->run();
+	return nullptr;
+}
+
+template <class Queue>
+ValueWriter<Queue>::ValueWriter(int expected_lines, std::string output_file, Queue* queue, int batch_size,
+	int flush_threshold)
+	: expected_lines(expected_lines), output_file(output_file), queue(queue), batch_size(batch_size),
+	  flush_threshold(flush_threshold) {
+}
+
+template <class Queue>
+void ValueWriter<Queue>::start() {
+	create(ValueWriter<Queue>::process, (void*)this);
+}
+
+template <class Queue>
+void ValueWriter<Queue>::run() {
+	int fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		perror(output_file.c_str());
+
+	std::vector<Item> items(batch_size);
+	std::vector<char> buffer(flush_threshold + batch_size * Writer::MAX_LINE);
+	size_t buffered = 0;
+	auto flush = [&]() {
+		size_t flushed = 0;
+		while (fd >= 0 && flushed < buffered) {
+			ssize_t w = write(fd, buffer.data() + flushed, buffered - flushed);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				perror("write");
+				break;
+			}
+			flushed += w;
+		}
+		buffered = 0;
+	};
+
+	int written = 0;
+	while (written < expected_lines) {
+		int n = queue->dequeue_bulk(items.data(), batch_size);
+		if (n == 0)
+			break;
+		for (int i = 0; i < n; i++)
+			buffered = Writer::format_line(buffer.data() + buffered, items[i]) - buffer.data();
+		written += n;
+		if ((int)buffered >= flush_threshold)
+			flush();
+	}
+	flush();
+
+	if (fd >= 0)
+		close(fd);
+}
+
+template <class Queue>
+void* ValueWriter<Queue>::process(void* arg) {
+	((ValueWriter<Queue>*)arg)->run();
+	return nullptr;
+}
+
+#endif // VALUE_STAGES_HPP
@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <atomic>
+
+#ifndef WORK_DEQUE_HPP
+#define WORK_DEQUE_HPP
+
+// Chase-Lev work-stealing deque with a fixed capacity.
+// The owner pushes and pops at the bottom without contention as long as the
+// deque holds more than one element, other threads steal from the top with
+// one CAS each.
+template <class T>
+class WorkDeque {
+public:
+	// constructor, capacity must be a power of 2
+	explicit WorkDeque(int capacity);
+
+	// destructor
+	~WorkDeque();
+
+	// add an element at the bottom, owner only,
+	// returns false when the deque is full
+	bool push(T item);
+
+	// remove the element at the bottom, owner only,
+	// returns false when the deque is empty
+	bool pop(T& item);
+
+	// remove the element at the top, any thread,
+	// returns false when the deque is empty or another thread won the race
+	bool steal(T& item);
+
+	// return the number of elements in the deque
+	int get_size();
+private:
+	int capacity;
+	// the slots of the ring, indexed by position & (capacity - 1)
+	std::atomic<T>* buffer;
+
+	// the position of the next steal
+	std::atomic<long long> top;
+	// the position of the next push
+	std::atomic<long long> bottom;
+};
+
+// Implementation start
+
+template <class T>
+WorkDeque<T>::WorkDeque(int capacity) : capacity(capacity), top(0), bottom(0) {
+	assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+	buffer = new std::atomic<T> [capacity];
+}
+
+template <class T>
+WorkDeque<T>::~WorkDeque() {
+	delete [] buffer;
+}
+
+template <class T>
+bool WorkDeque<T>::push(T item) {
+	long long b = bottom.load(std::memory_order_relaxed);
+	long long t = top.load(std::memory_order_acquire);
+	if (b - t >= capacity)
+		return false;
+	buffer[b & (capacity - 1)].store(item, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+template <class T>
+bool WorkDeque<T>::pop(T& item) {
+	long long b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long long t = top.load(std::memory_order_relaxed);
+
+	if (t > b) {
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+	item = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+	if (t == b) {
+		// the last element, race the thieves for it
+		bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+template <class T>
+bool WorkDeque<T>::steal(T& item) {
+	long long t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long long b = bottom.load(std::memory_order_acquire);
+
+	if (t >= b)
+		return false;
+	item = buffer[t & (capacity - 1)].load(std::memory_order_relaxed);
+	return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template <class T>
+int WorkDeque<T>::get_size() {
+	long long size = bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed);
+	return size > 0 ? (int)size : 0;
+}
+
+#endif // WORK_DEQUE_HPP
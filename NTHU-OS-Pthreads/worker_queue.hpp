@@ -0,0 +1,31 @@
+#include "item_queue.hpp"
+#include "opcode_queue.hpp"
+#include "cost_model.hpp"
+
+#ifndef WORKER_QUEUE_HPP
+#define WORKER_QUEUE_HPP
+
+// The queue between the Producers and the Consumers.
+// Build with -DOPCODE_ROUTING to split it by opcode and serve the cheapest
+// classes first, see OpcodeQueue, instead of one FIFO ItemQueue, e.g.
+// make DEFINES=-DOPCODE_ROUTING
+// Every target builds with it, the stage tests move items by hand between
+// the worker queue and the ItemQueue of their Reader or Writer.
+#ifdef OPCODE_ROUTING
+typedef OpcodeQueue WorkerQueue;
+#else
+typedef ItemQueue WorkerQueue;
+#endif
+
+// the cost model a worker queue learns from the consumers,
+// nullptr for the queues without one
+template <class Queue>
+CostModel* cost_model_of(Queue*) {
+	return nullptr;
+}
+
+inline CostModel* cost_model_of(OpcodeQueue* queue) {
+	return queue->get_costs();
+}
+
+#endif // WORKER_QUEUE_HPP
@@ -1,27 +1,81 @@
-#include <fstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "stats.hpp"
 
 #ifndef WRITER_HPP
 #define WRITER_HPP
 
+// the number of buffered output bytes that triggers a write
+#define DEFAULT_FLUSH_THRESHOLD (1 << 16)
+
 class Writer : public Thread {
 public:
 	// constructor
-	Writer(int expected_lines, std::string output_file, TSQueue<Item*>* output_queue);
+	Writer(int expected_lines, std::string output_file, ItemQueue* output_queue, int batch_size = 1,
+		ItemPool* pool = nullptr, int flush_threshold = DEFAULT_FLUSH_THRESHOLD);
+
+	// constructor of a shard, the writer threads sharing one output queue
+	// each write to their own file until they wrote shared_lines together
+	Writer(std::atomic<int>* shared_lines, std::string output_file, ItemQueue* output_queue, int batch_size = 1,
+		ItemPool* pool = nullptr, int flush_threshold = DEFAULT_FLUSH_THRESHOLD);
 
 	// destructor
 	~Writer();
 
 	virtual void start() override;
+
+	// concatenates the shard files into output_file and removes them,
+	// returns false and keeps every shard when the merge fails
+	static bool merge(std::vector<std::string> shard_files, std::string output_file);
+
+	// the expected lines of a writer that runs until its output queue is
+	// closed and drained
+	static const int UNTIL_CLOSED = INT_MAX;
+
+	// the longest line format_line writes
+	static const int MAX_LINE = 48;
+
+	// formats item as a line at out, returns the end of the line
+	static char* format_line(char* out, const Item& item);
 private:
+	// takes up to max lines from the expected lines, returns how many
+	int claim(int max);
+
+	// formats item at the end of the buffer
+	void format(const Item& item);
+
+	// writes out the buffer
+	void flush();
+
 	// the expected lines to write,
 	// the writer thread finished after output expected lines of item
-	int expected_lines;
+	std::atomic<int>* expected_lines;
+	// whether expected_lines belongs to this writer only
+	bool owns_expected_lines;
+
+	int fd;
+	ItemQueue* output_queue;
 
-	std::ofstream ofs;
-	TSQueue<Item*> *output_queue;
+	// the maximum number of items taken from the output queue at once
+	int batch_size;
+
+	// where written items go back to, items are deleted when there is no pool
+	ItemPool* pool;
+
+	// the formatted output not written yet
+	std::vector<char> buffer;
+	size_t buffered;
+	size_t flush_threshold;
 
 	// the method for pthread to create a writer thread
 	static void* process(void* arg);
@@ -29,28 +83,195 @@ private:
 
 // Implementation start
 
-Writer::Writer(int expected_lines, std::string output_file, TSQueue<Item*>* output_queue)
-	: expected_lines(expected_lines), output_queue(output_queue) {
-	ofs = std::ofstream(output_file);
+Writer::Writer(int expected_lines, std::string output_file, ItemQueue* output_queue, int batch_size,
+	ItemPool* pool, int flush_threshold)
+	: Writer(new std::atomic<int>(expected_lines), output_file, output_queue, batch_size, pool, flush_threshold) {
+	owns_expected_lines = true;
+}
+
+Writer::Writer(std::atomic<int>* shared_lines, std::string output_file, ItemQueue* output_queue, int batch_size,
+	ItemPool* pool, int flush_threshold)
+	: expected_lines(shared_lines), owns_expected_lines(false), output_queue(output_queue), batch_size(batch_size),
+	  pool(pool), buffered(0), flush_threshold(flush_threshold) {
+	fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		perror(output_file.c_str());
+	// room for the threshold plus one batch of the longest lines
+	buffer.resize(flush_threshold + batch_size * MAX_LINE);
 }
 
 Writer::~Writer() {
-	ofs.close();
+	if (fd >= 0)
+		close(fd);
+	if (owns_expected_lines)
+		delete expected_lines;
 }
 
 void Writer::start() {
 	// TODO: starts a Writer thread
-	pthread_create(&t, 0, Writer::process, (void *)this);
+	create(Writer::process, (void*)this);
+}
+
+bool Writer::merge(std::vector<std::string> shard_files, std::string output_file) {
+	int out = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		perror(output_file.c_str());
+		return false;
+	}
+	std::vector<char> chunk(DEFAULT_FLUSH_THRESHOLD);
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < shard_files.size(); i++) {
+		int in = open(shard_files[i].c_str(), O_RDONLY);
+		if (in < 0) {
+			perror(shard_files[i].c_str());
+			ok = false;
+			break;
+		}
+		ssize_t n;
+		while (ok && (n = read(in, chunk.data(), chunk.size())) != 0) {
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				perror(shard_files[i].c_str());
+				ok = false;
+				break;
+			}
+			for (ssize_t written = 0; written < n; ) {
+				ssize_t w = write(out, chunk.data() + written, n - written);
+				if (w < 0) {
+					if (errno == EINTR)
+						continue;
+					perror(output_file.c_str());
+					ok = false;
+					break;
+				}
+				written += w;
+			}
+		}
+		close(in);
+	}
+	if (close(out) < 0) {
+		perror(output_file.c_str());
+		ok = false;
+	}
+
+	// the shards are the only copy of the output until the merge is complete
+	if (ok) {
+		for (const std::string& shard_file : shard_files)
+			unlink(shard_file.c_str());
+	}
+	return ok;
+}
+
+int Writer::claim(int max) {
+	int left = expected_lines->load();
+	while (left > 0) {
+		int n = std::min(left, max);
+		if (expected_lines->compare_exchange_weak(left, left - n))
+			return n;
+	}
+	return 0;
+}
+
+void Writer::format(const Item& item) {
+	buffered = format_line(buffer.data() + buffered, item) - buffer.data();
+}
+
+char* Writer::format_line(char* out, const Item& item) {
+	// the same text as operator<<(std::ostream&, const Item&)
+	char digits[24];
+	int len;
+
+	unsigned int key = item.key < 0 ? -(unsigned int)item.key : item.key;
+	if (item.key < 0)
+		*out++ = '-';
+	len = 0;
+	do {
+		digits[len++] = '0' + key % 10;
+		key /= 10;
+	} while (key);
+	while (len)
+		*out++ = digits[--len];
+	*out++ = ' ';
+
+	unsigned long long val = item.val;
+	len = 0;
+	do {
+		digits[len++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	while (len)
+		*out++ = digits[--len];
+	*out++ = ' ';
+
+	*out++ = item.opcode;
+	*out++ = '\n';
+
+	return out;
+}
+
+void Writer::flush() {
+	size_t written = 0;
+	while (fd >= 0 && written < buffered) {
+		ssize_t n = write(fd, buffer.data() + written, buffered - written);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			break;
+		}
+		written += n;
+	}
+	buffered = 0;
 }
 
 void* Writer::process(void* arg) {
 	// TODO: implements the Writer's work
 	Writer* writer = (Writer*)arg;
 
-	while (writer->expected_lines--) {
-		Item *item = writer->output_queue->dequeue();
-		writer->ofs << *item;
+	std::vector<Item*> batch(writer->batch_size);
+	ItemPool::Cache* cache = writer->pool ? new ItemPool::Cache(writer->pool) : nullptr;
+	Stats::Recorder* stats = Stats::recorder("writer");
+	long long begin = 0;
+
+	int claimed;
+	bool drained = false;
+	while (!drained && (claimed = writer->claim(writer->batch_size)) > 0) {
+		// the claims of all shards add up to the expected lines,
+		// so the claimed items are on their way unless the queue is closed
+		while (claimed > 0) {
+			if (stats)
+				begin = Stats::now();
+			int n = writer->output_queue->dequeue_bulk(batch.data(), claimed);
+			if (stats) {
+				long long end = Stats::now();
+				stats->dequeue_wait.record(end - begin);
+				stats->handled(n, end);
+			}
+			// closed and empty, the rest of the claim never comes
+			if (n == 0) {
+				drained = true;
+				break;
+			}
+			for (int i = 0; i < n; i++) {
+				writer->format(*batch[i]);
+				if (cache)
+					cache->release(batch[i]);
+				else
+					delete batch[i];
+			}
+			// the Reader may be waiting for items, never keep them across a dequeue
+			if (cache)
+				cache->flush();
+			claimed -= n;
+		}
+		if (writer->buffered >= writer->flush_threshold)
+			writer->flush();
 	}
+	writer->flush();
+
+	delete cache;
 
 	return nullptr;
 }
@@ -1,9 +1,9 @@
 #include <unistd.h>
-#include "ts_queue.hpp"
+#include "item_queue.hpp"
 #include "writer.hpp"
 
 int main() {
-	TSQueue<Item*>* q = new TSQueue<Item*>;
+	ItemQueue* q = new ItemQueue;
 
 	Writer* writer = new Writer(80, "./tests/00.out", q);
 